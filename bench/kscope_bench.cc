@@ -0,0 +1,340 @@
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/TargetParser/Host.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "codegen/parallel_map.h"
+#include "codegen/renderer.h"
+#include "codegen/runtime.h"
+#include "engine/engine.h"
+#include "parsing/tree.h"
+
+/// kscope_bench - throughput of the front end and code generator, latency
+/// of the JIT, and speed of the generated code at every optimization level.
+/// Each measurement repeats until -min-time has passed; results go to JSON
+/// so runs of different releases can be compared.
+
+static llvm::cl::opt<std::string> output_file(
+    "o",
+    llvm::cl::desc("Write the results as JSON to this file (default = stdout)"),
+    llvm::cl::value_desc("filename"),
+    llvm::cl::init("-"));
+
+static llvm::cl::opt<double> min_time(
+    "min-time",
+    llvm::cl::desc("Minimum time per measurement, in seconds (default = 0.5)"),
+    llvm::cl::init(0.5));
+
+static llvm::cl::opt<unsigned> source_size(
+    "source-size",
+    llvm::cl::desc("Size of the synthetic source for parsing and codegen, in KB (default = 4096)"),
+    llvm::cl::init(4096));
+
+static llvm::cl::opt<std::string> filter(
+    "filter",
+    llvm::cl::desc("Only run the benchmarks whose name contains this string"),
+    llvm::cl::init(""));
+
+using Clock = std::chrono::steady_clock;
+
+static double
+seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double seconds;  // Measured time over all iterations
+    double value;
+    const char *unit;
+};
+
+static std::vector<Result> results;
+
+static bool
+selected(llvm::StringRef name) {
+    return filter.empty() || name.contains(filter);
+}
+
+static void
+report(Result result) {
+    llvm::errs() << llvm::format("%-32s %12.3f %-10s (%llu iterations)\n",
+                                 result.name.c_str(), result.value, result.unit,
+                                 (unsigned long long)result.iterations);
+    results.push_back(std::move(result));
+}
+
+static void
+check(llvm::Error err, llvm::StringRef what) {
+    if ( err ) {
+        llvm::errs() << what << ": " << err << "\n";
+        exit(1);
+    }
+}
+
+/// synthetic_source - distinct definitions with branches, loops, locals and
+/// calls to the previous definition, up to about size bytes.
+static std::string
+synthetic_source(size_t size, unsigned &functions) {
+    std::string source;
+    functions = 0;
+    while ( source.size() < size ) {
+        std::string name = "f" + std::to_string(functions);
+        std::string body = functions == 0
+            ? "x * y + 1"
+            : "f" + std::to_string(functions - 1) + "(y, x - 1)";
+        source += "def " + name + "(x y)\n"
+                  "  if x < y then x * 2.5 + " + body + "\n"
+                  "  else var t = x, u in (for k = 0, k < y in t = t + k / 3) + t * u;\n";
+        functions++;
+    }
+    return source;
+}
+
+static void
+bench_parse(const std::string &source) {
+    STree tree;
+    uint64_t iterations = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        if ( !tree.parse(source, [](ASTNode *) {}) ) {
+            llvm::errs() << "parse: syntax error in synthetic source\n";
+            exit(1);
+        }
+        iterations++;
+    } while ( seconds_since(start) < min_time );
+
+    double seconds = seconds_since(start);
+    double megabytes = double(source.size()) * iterations / (1024 * 1024);
+    report({"parse", iterations, seconds, megabytes / seconds, "MB/s"});
+}
+
+/// Only the calls to codegen are timed; every round starts a new session so
+/// the module does not keep growing.
+static void
+bench_codegen(const std::shared_ptr<JITRuntime> &runtime,
+              const std::string &source, unsigned functions) {
+    STree tree;
+    uint64_t iterations = 0;
+    double seconds = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        IRRenderer renderer(runtime);
+        bool parsed = tree.parse(source, [&](ASTNode *root) {
+            Clock::time_point before = Clock::now();
+            if ( root->codegen(&renderer) == nullptr ) {
+                llvm::errs() << "codegen: could not compile synthetic source\n";
+                exit(1);
+            }
+            seconds += seconds_since(before);
+        });
+        if ( !parsed ) { exit(1); }
+        iterations++;
+    } while ( seconds_since(start) < min_time );
+
+    report({"codegen", iterations, seconds, double(functions) * iterations / seconds,
+            "functions/s"});
+}
+
+/// One small module per iteration, timed from handing it to the JIT until
+/// its address is known.
+static void
+bench_jit(unsigned opt_level) {
+    RendererOptions options;
+    options.opt_level = opt_level;
+    auto runtime = kscope::create_runtime(options);
+    IRRenderer renderer(runtime);
+    STree tree;
+
+    uint64_t iterations = 0;
+    double seconds = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        std::string name = "j" + std::to_string(iterations);
+        std::string source = "def " + name + "(x) if x < 1 then x * 3 else " + name + "(x - 1) + 1";
+        tree.parse(source, [&](ASTNode *root) { root->codegen(&renderer); });
+
+        Clock::time_point before = Clock::now();
+        check(renderer.flush_definitions(), "jit");
+        auto address = renderer.lookup(name);
+        if ( !address ) { check(address.takeError(), "jit"); }
+        seconds += seconds_since(before);
+        iterations++;
+    } while ( seconds_since(start) < min_time );
+
+    report({"jit/O" + std::to_string(opt_level), iterations, seconds,
+            seconds / iterations * 1e6, "us/module"});
+}
+
+struct Kernel {
+    const char *name;
+    double argument;
+};
+
+static const char *kernel_source =
+    "def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2);\n"
+    "def loop(n) var s = 0 in (for i = 0, i < n in s = s + i * 0.5) + s;\n"
+    "def nested(n) var s = 0 in (for i = 0, i < n in for j = 0, j < n in s = s + i * j / n) + s;\n";
+
+static const Kernel kernels[] = {
+    {"fib", 27},
+    {"loop", 1e7},
+    {"nested", 2000},
+};
+
+static std::string
+kernel_name(const Kernel &kernel, unsigned opt_level) {
+    return std::string("kernel/") + kernel.name + "/O" + std::to_string(opt_level);
+}
+
+static void
+bench_kernels(unsigned opt_level) {
+    // Compiling the kernels is slow at O3; skip it when none would run
+    if ( std::none_of(std::begin(kernels), std::end(kernels), [&](const Kernel &kernel) {
+             return selected(kernel_name(kernel, opt_level));
+         }) ) {
+        return;
+    }
+
+    RendererOptions options;
+    options.opt_level = opt_level;
+    kscope::Engine engine(options);
+    check(engine.compile(kernel_source), "kernels");
+
+    for ( const Kernel &kernel : kernels ) {
+        std::string name = kernel_name(kernel, opt_level);
+        if ( !selected(name) ) { continue; }
+
+        auto func = engine.lookup<double(double)>(kernel.name);
+        if ( !func ) { check(func.takeError(), name); }
+
+        // Warm up caches and branch predictors before timing
+        volatile double sink = (*func)(kernel.argument);
+
+        uint64_t iterations = 0;
+        Clock::time_point start = Clock::now();
+        do {
+            sink = (*func)(kernel.argument);
+            iterations++;
+        } while ( seconds_since(start) < min_time );
+        (void)sink;
+
+        double seconds = seconds_since(start);
+        report({name, iterations, seconds, seconds / iterations * 1e3, "ms/call"});
+    }
+}
+
+/// ParallelMap over one large array at 1, 2, 4, ... threads, up to the
+/// hardware threads, to show how it scales.
+static void
+bench_parallel_map() {
+    RendererOptions options;
+    options.opt_level = 3;
+    kscope::Engine engine(options);
+    check(engine.compile("def wave(x y) var s = 0 in\n"
+                         "  (for k = 0, k < 8 in s = s + x * k / (y + k + 1)) + s;"),
+          "parallel_map");
+    auto map = engine.array_map("wave");
+    if ( !map ) { check(map.takeError(), "parallel_map"); }
+
+    const size_t rows = size_t(1) << 22;
+    std::vector<double> x(rows), y(rows), out(rows);
+    for ( size_t i = 0; i < rows; i++ ) {
+        x[i] = double(i % 1000) / 7;
+        y[i] = double(i % 13);
+    }
+
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    for ( unsigned threads = 1; ; threads = std::min(threads * 2, hardware) ) {
+        ParallelMap pool(threads);
+        uint64_t iterations = 0;
+        Clock::time_point start = Clock::now();
+        do {
+            check(pool(*map, out.data(), rows, x.data(), y.data()), "parallel_map");
+            iterations++;
+        } while ( seconds_since(start) < min_time );
+
+        double seconds = seconds_since(start);
+        report({"parallel_map/" + std::to_string(threads) + "t", iterations, seconds,
+                double(rows) * iterations / seconds / 1e6, "Mrows/s"});
+        if ( threads == hardware ) { break; }
+    }
+}
+
+static void
+write_results(llvm::raw_ostream &out) {
+    llvm::json::OStream json(out, 2);
+    json.object([&] {
+        json.attributeObject("context", [&] {
+            json.attribute("llvm_version", LLVM_VERSION_STRING);
+            json.attribute("host_cpu", llvm::sys::getHostCPUName());
+            json.attribute("min_time", min_time.getValue());
+        });
+        json.attributeArray("benchmarks", [&] {
+            for ( const Result &result : results ) {
+                json.object([&] {
+                    json.attribute("name", result.name);
+                    json.attribute("iterations", static_cast<int64_t>(result.iterations));
+                    json.attribute("seconds", result.seconds);
+                    json.attribute("value", result.value);
+                    json.attribute("unit", result.unit);
+                });
+            }
+        });
+    });
+    out << "\n";
+}
+
+int main(int argc, char **argv) {
+    llvm::cl::ParseCommandLineOptions(argc, argv, "kscope_bench - kscope benchmarks\n");
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    unsigned functions = 0;
+    std::string source = synthetic_source(size_t(source_size) * 1024, functions);
+
+    if ( selected("parse") ) {
+        bench_parse(source);
+    }
+    if ( selected("codegen") ) {
+        RendererOptions options;
+        options.opt_level = 0;  // Keep the function pipeline out of it
+        bench_codegen(kscope::create_runtime(options), source, functions);
+    }
+    for ( unsigned level = 0; level <= 3; level++ ) {
+        if ( selected("jit/O" + std::to_string(level)) ) {
+            bench_jit(level);
+        }
+    }
+    for ( unsigned level = 0; level <= 3; level++ ) {
+        bench_kernels(level);
+    }
+    if ( selected("parallel_map") ) {
+        bench_parallel_map();
+    }
+
+    std::error_code error;
+    llvm::raw_fd_ostream out(output_file, error);
+    if ( error ) {
+        llvm::errs() << "Failed to write " << output_file << ": " << error.message() << "\n";
+        return 1;
+    }
+    write_results(out);
+    return 0;
+}
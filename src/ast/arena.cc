@@ -0,0 +1,40 @@
+#include "llvm/ADT/StringRef.h"
+
+#include "arena.h"
+
+
+ASTArena::ASTArena() : identifiers(std::make_unique<Interner>()) {}
+
+ASTArena::~ASTArena() {
+  destroy_objects();
+}
+
+void
+ASTArena::destroy_objects() {
+  for ( auto it = cleanups.rbegin(); it != cleanups.rend(); ++it ) {
+    it->second(it->first);
+  }
+  cleanups.clear();
+}
+
+Identifier
+ASTArena::intern(llvm::StringRef name) {
+  return identifiers->intern(name);
+}
+
+void
+ASTArena::reset_nodes() {
+  destroy_objects();
+  nodes.Reset();
+}
+
+void
+ASTArena::reset() {
+  reset_nodes();
+  identifiers = std::make_unique<Interner>();
+}
+
+size_t
+ASTArena::bytes_allocated() const {
+  return nodes.getBytesAllocated();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+#include "identifier.h"
+#include "node.h"
+
+
+/// ASTArena - bump allocator for everything a parse produces.
+///
+/// AST nodes only hold identifiers, pointers and arrays that live in the
+/// arena themselves, so they are released as a whole without running
+/// destructors. Other objects (the parser's temporary lists) get their
+/// destructors run on reset. Identifiers are interned separately so they
+/// can outlive the nodes of a single statement.
+class ASTArena {
+  llvm::BumpPtrAllocator nodes;
+  std::vector<std::pair<void*, void (*)(void*)> > cleanups;
+  std::unique_ptr<Interner> identifiers;
+
+  void destroy_objects();
+
+public:
+  ASTArena();
+  ~ASTArena();
+
+  template <typename T, typename... Args>
+  T *make(Args &&...args) {
+    T *object = new (nodes.Allocate<T>()) T(std::forward<Args>(args)...);
+    if ( !std::is_base_of<ASTNode, T>::value &&
+         !std::is_trivially_destructible<T>::value ) {
+      cleanups.emplace_back(object, [](void *p) { static_cast<T*>(p)->~T(); });
+    }
+    return object;
+  }
+
+  template <typename T>
+  llvm::ArrayRef<T> copy(llvm::ArrayRef<T> items) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena arrays are never destroyed");
+    if ( items.empty() ) { return llvm::ArrayRef<T>(); }
+
+    T *data = nodes.Allocate<T>(items.size());
+    std::uninitialized_copy(items.begin(), items.end(), data);
+    return llvm::ArrayRef<T>(data, items.size());
+  }
+
+  Identifier intern(llvm::StringRef name);
+
+  // Release all nodes and lists; interned identifiers stay valid.
+  void reset_nodes();
+  // Release everything, including identifiers.
+  void reset();
+
+  size_t bytes_allocated() const;
+};
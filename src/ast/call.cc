@@ -1,8 +1,7 @@
-#include <string>
-#include <vector>
+#include "llvm/ADT/ArrayRef.h"
 
 #include "node.h"
 #include "call.h"
 
-CallNode::CallNode(const std::string &callee, std::vector<ASTNode*> &args)
+CallNode::CallNode(Identifier callee, llvm::ArrayRef<ASTNode*> args)
     : callee(callee), args(args) {}
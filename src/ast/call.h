@@ -1,19 +1,18 @@
 #pragma once
 
-#include <string>
-#include <vector>
-
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/IR/Value.h"
 
+#include "identifier.h"
 #include "node.h"
 #include "codegen/renderer.h"
 
 
 class CallNode : public ASTNode {
-  std::string callee;
-  std::vector<ASTNode*> args;
+  Identifier callee;
+  llvm::ArrayRef<ASTNode*> args;
 
 public:
-  CallNode(const std::string &callee, std::vector<ASTNode*> &args);
+  CallNode(Identifier callee, llvm::ArrayRef<ASTNode*> args);
   virtual llvm::Value *codegen(IRRenderer *renderer) override final;
 };
@@ -1,10 +1,8 @@
-#include <string>
-
 #include "node.h"
 #include "for.h"
 
 
-ForNode::ForNode(const std::string &var_name,
+ForNode::ForNode(Identifier var_name,
                  ASTNode *start, ASTNode *end,
                  ASTNode *step,
                  ASTNode *body)
@@ -4,3 +4,8 @@
 
 FunctionNode::FunctionNode(PrototypeNode *proto, ASTNode *body)
     : proto(proto), body(body) {}
+
+bool
+FunctionNode::is_anonymous() const {
+  return proto->getName().str().substr(0, 11) == "__anon_expr";
+}
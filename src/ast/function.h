@@ -14,5 +14,6 @@ class FunctionNode : public ASTNode {
 
 public:
   FunctionNode(PrototypeNode *proto, ASTNode *body);
+  bool is_anonymous() const;
   llvm::Function *codegen(IRRenderer *renderer);
 };
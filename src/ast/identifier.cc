@@ -0,0 +1,12 @@
+#include "llvm/ADT/StringRef.h"
+
+#include "identifier.h"
+
+
+Interner::Interner() : strings(arena) {}
+
+Identifier
+Interner::intern(llvm::StringRef name) {
+  llvm::StringRef saved = strings.save(name);
+  return Identifier(saved.data(), saved.size());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+
+
+/// Identifier - a name interned in an Interner. Two identifiers from the
+/// same interner are equal exactly when their data pointers are, so they
+/// hash and compare in O(1). Trivial, so it can live in the parser's
+/// semantic value union.
+class Identifier {
+  const char *data;
+  size_t length;
+
+  Identifier(const char *data, size_t length) : data(data), length(length) {}
+  friend class Interner;
+
+public:
+  Identifier() = default;
+
+  llvm::StringRef str() const { return llvm::StringRef(data, length); }
+  const void *key() const { return data; }
+
+  bool operator ==(const Identifier &other) const { return data == other.data; }
+  bool operator !=(const Identifier &other) const { return data != other.data; }
+};
+
+class Interner {
+  llvm::BumpPtrAllocator arena;
+  llvm::UniqueStringSaver strings;
+
+public:
+  Interner();
+
+  Identifier intern(llvm::StringRef name);
+};
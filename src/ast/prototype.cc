@@ -1,9 +1,12 @@
-#include <string>
-#include <vector>
+#include "llvm/ADT/ArrayRef.h"
 
 #include "prototype.h"
 
 
-PrototypeNode::PrototypeNode(const std::string &name,
-                             const std::vector<std::string> &args)
+PrototypeNode::PrototypeNode(Identifier name, llvm::ArrayRef<Identifier> args)
     : name(name), args(args) {}
+
+Identifier
+PrototypeNode::getName() const {
+  return name;
+}
@@ -1,22 +1,21 @@
 #pragma once
 
-#include <string>
-#include <vector>
-
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/IR/Module.h"
 
+#include "identifier.h"
 #include "node.h"
 #include "codegen/renderer.h"
 
 
 class PrototypeNode : public ASTNode {
-  std::string name;
-  std::vector<std::string> args;
+  Identifier name;
+  llvm::ArrayRef<Identifier> args;
 
 public:
-  PrototypeNode(const std::string &name,
-                const std::vector<std::string> &args);
+  PrototypeNode(Identifier name, llvm::ArrayRef<Identifier> args);
 
+  Identifier getName() const;
   llvm::Function *codegen(IRRenderer *renderer);
   void create_argument_allocas(IRRenderer *renderer, llvm::Function *func);
 };
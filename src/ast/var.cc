@@ -1,10 +1,8 @@
-#include <string>
-#include <vector>
+#include "llvm/ADT/ArrayRef.h"
 
 #include "node.h"
 #include "var.h"
 
 
-VarNode::VarNode(const std::vector<std::pair<std::string, ASTNode*> > &var_names,
-                 ASTNode *body)
+VarNode::VarNode(llvm::ArrayRef<Declaration> var_names, ASTNode *body)
     : var_names(var_names), body(body) {}
@@ -1,20 +1,24 @@
 #pragma once
 
-#include <string>
-#include <vector>
+#include <utility>
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/IR/Value.h"
 
+#include "identifier.h"
 #include "node.h"
 #include "codegen/renderer.h"
 
 
 class VarNode : public ASTNode {
-  std::vector<std::pair<std::string, ASTNode*> > var_names;
+public:
+  typedef std::pair<Identifier, ASTNode*> Declaration;
+
+private:
+  llvm::ArrayRef<Declaration> var_names;
   ASTNode *body;
 
 public:
-  VarNode(const std::vector<std::pair<std::string, ASTNode*> > &var_names,
-          ASTNode *body);
+  VarNode(llvm::ArrayRef<Declaration> var_names, ASTNode *body);
   virtual llvm::Value *codegen(IRRenderer *renderer) override final;
 };
@@ -1,11 +1,9 @@
-#include <string>
-
 #include "variable.h"
 
-VariableNode::VariableNode(const std::string &name)
+VariableNode::VariableNode(Identifier name)
     : name(name) {}
 
-const std::string
+Identifier
 VariableNode::getName() const {
   return name;
 }
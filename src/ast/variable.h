@@ -1,18 +1,17 @@
 #pragma once
 
-#include <string>
-
 #include "llvm/IR/Value.h"
 
+#include "identifier.h"
 #include "node.h"
 #include "codegen/renderer.h"
 
 
 class VariableNode : public ASTNode {
-  std::string name;
+  Identifier name;
 
 public:
-  VariableNode(const std::string &name);
-  const std::string getName() const;
+  VariableNode(Identifier name);
+  Identifier getName() const;
   virtual llvm::Value *codegen(IRRenderer *renderer) override final;
 };
@@ -0,0 +1,78 @@
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+
+#include <vector>
+
+#include "array_map.h"
+
+using ::llvm::BasicBlock;
+using ::llvm::Function;
+using ::llvm::IRBuilder;
+using ::llvm::Type;
+using ::llvm::Value;
+
+
+Function *
+create_map_wrapper(llvm::Module &module, Function *scalar) {
+    llvm::LLVMContext &context = module.getContext();
+    Type *double_type = Type::getDoubleTy(context);
+    Type *pointer_type = llvm::PointerType::getUnqual(context);
+    Type *size_type = module.getDataLayout().getIntPtrType(context);
+    unsigned arity = scalar->arg_size();
+
+    // One input array per parameter, then the output and the length
+    std::vector<Type*> param_types(arity + 1, pointer_type);
+    param_types.push_back(size_type);
+    llvm::FunctionType *type = llvm::FunctionType::get(Type::getVoidTy(context),
+                                                       param_types, false);
+
+    Function *wrapper = Function::Create(type, Function::ExternalLinkage,
+                                         scalar->getName() + "_map", module);
+    for ( unsigned i = 0; i <= arity; i++ ) {
+        wrapper->addParamAttr(i, llvm::Attribute::NoAlias);
+        wrapper->addParamAttr(i, llvm::Attribute::NoCapture);
+        if ( i < arity ) {
+            wrapper->addParamAttr(i, llvm::Attribute::ReadOnly);
+        }
+    }
+
+    BasicBlock *entry = BasicBlock::Create(context, "entry", wrapper);
+    BasicBlock *loop = BasicBlock::Create(context, "loop", wrapper);
+    BasicBlock *exit = BasicBlock::Create(context, "exit", wrapper);
+
+    IRBuilder<> builder(entry);
+    Value *n = wrapper->getArg(arity + 1);
+    Value *out = wrapper->getArg(arity);
+    builder.CreateCondBr(builder.CreateICmpEQ(n, llvm::ConstantInt::get(size_type, 0)),
+                         exit, loop);
+
+    builder.SetInsertPoint(loop);
+    llvm::PHINode *index = builder.CreatePHI(size_type, 2, "i");
+    index->addIncoming(llvm::ConstantInt::get(size_type, 0), entry);
+
+    std::vector<Value*> args;
+    for ( unsigned i = 0; i < arity; i++ ) {
+        Value *element = builder.CreateInBoundsGEP(double_type, wrapper->getArg(i), index);
+        args.push_back(builder.CreateLoad(double_type, element));
+    }
+    Value *result = builder.CreateCall(scalar, args);
+    builder.CreateStore(result, builder.CreateInBoundsGEP(double_type, out, index));
+
+    Value *next = builder.CreateAdd(index, llvm::ConstantInt::get(size_type, 1),
+                                    "next", true, true);
+    index->addIncoming(next, loop);
+    builder.CreateCondBr(builder.CreateICmpEQ(next, n), exit, loop);
+
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+
+    llvm::verifyFunction(*wrapper);
+    return wrapper;
+}
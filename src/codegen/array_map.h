@@ -0,0 +1,48 @@
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorAddress.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+
+/// ArrayMap - a compiled kscope function applied element wise over arrays,
+/// through a generated wrapper
+///
+///     void f_map(const double *x, const double *y, double *out, size_t n);
+///
+/// with the scalar body inlined so the loop can be vectorized. Inputs and
+/// output must not overlap.
+class ArrayMap {
+    llvm::orc::ExecutorAddr entry;
+    unsigned arity;
+    bool pure;
+
+public:
+    ArrayMap() : arity(0), pure(false) {}
+    ArrayMap(llvm::orc::ExecutorAddr entry, unsigned arity, bool pure)
+        : entry(entry), arity(arity), pure(pure) {}
+
+    unsigned inputs() const { return arity; }
+    llvm::orc::ExecutorAddr address() const { return entry; }
+
+    // No calls with side effects, so slices may run concurrently
+    bool is_pure() const { return pure; }
+
+    template <typename... Columns>
+    void operator ()(double *out, size_t n, const Columns *...columns) const {
+        static_assert((std::is_same<Columns, double>::value && ...),
+                      "kscope functions take doubles");
+        assert(sizeof...(Columns) == arity && "wrong number of input arrays");
+
+        auto map = entry.toPtr<void (*)(const Columns*..., double*, size_t)>();
+        map(columns..., out, n);
+    }
+};
+
+/// create_map_wrapper - generate name_map for scalar into module. The
+/// scalar function must be declared (or defined) in module.
+llvm::Function *create_map_wrapper(llvm::Module &module, llvm::Function *scalar);
@@ -0,0 +1,181 @@
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include <optional>
+#include <string>
+
+#include "emitter.h"
+
+
+/// Lines of "name arity [pure]", in a section of its own
+static const char *
+signature_section(const llvm::Triple &triple) {
+    return triple.isOSBinFormatMachO() ? "__DATA,__kscope_sig" : ".kscope_sig";
+}
+
+static void
+embed_signatures(llvm::Module &module, const llvm::Triple &triple) {
+    std::string table;
+    for ( auto &func : module ) {
+        if ( func.isDeclaration() ) { continue; }
+        table += func.getName().str() + " " + std::to_string(func.arg_size());
+        table += func.doesNotAccessMemory() ? " pure\n" : "\n";
+    }
+    if ( table.empty() ) { return; }
+
+    llvm::Constant *init = llvm::ConstantDataArray::getString(module.getContext(), table, false);
+    auto *global = new llvm::GlobalVariable(module, init->getType(), true,
+                                            llvm::GlobalValue::PrivateLinkage,
+                                            init, "__kscope_signatures");
+    global->setSection(signature_section(triple));
+    global->setAlignment(llvm::Align(1));
+    llvm::appendToUsed(module, {global});
+}
+
+static llvm::Error
+emit_native(llvm::Module &module,
+            llvm::TargetMachine &target,
+            llvm::CodeGenFileType type,
+            llvm::StringRef path) {
+    std::error_code ec;
+    auto flags = type == llvm::CodeGenFileType::AssemblyFile
+        ? llvm::sys::fs::OF_Text
+        : llvm::sys::fs::OF_None;
+    llvm::ToolOutputFile out(path, ec, flags);
+    if ( ec ) {
+        return llvm::createFileError(path, ec);
+    }
+
+    llvm::legacy::PassManager passes;
+    if ( target.addPassesToEmitFile(passes, out.os(), nullptr, type) ) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "target cannot emit this file type");
+    }
+    passes.run(module);
+
+    out.keep();
+    return llvm::Error::success();
+}
+
+static llvm::Error
+link_shared_library(llvm::StringRef object, llvm::StringRef path) {
+    auto cc = llvm::sys::findProgramByName("cc");
+    if ( !cc ) {
+        return llvm::createStringError(cc.getError(), "no cc found to link with");
+    }
+
+    std::string message;
+    llvm::StringRef args[] = {*cc, "-shared", "-o", path, object};
+    int status = llvm::sys::ExecuteAndWait(*cc, args, std::nullopt, {}, 0, 0, &message);
+    if ( status != 0 ) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "linking %s failed: %s",
+                                       path.str().c_str(), message.c_str());
+    }
+    return llvm::Error::success();
+}
+
+llvm::Error
+emit_module(llvm::Module &module,
+            llvm::TargetMachine &target,
+            EmitKind kind,
+            llvm::StringRef path) {
+    module.setDataLayout(target.createDataLayout());
+    module.setTargetTriple(target.getTargetTriple().str());
+
+    if ( kind != EmitKind::IR && kind != EmitKind::Bitcode ) {
+        embed_signatures(module, target.getTargetTriple());
+    }
+
+    switch (kind) {
+    case EmitKind::Object:
+        return emit_native(module, target, llvm::CodeGenFileType::ObjectFile, path);
+
+    case EmitKind::Assembly:
+        return emit_native(module, target, llvm::CodeGenFileType::AssemblyFile, path);
+
+    case EmitKind::SharedLibrary: {
+        llvm::SmallString<128> object;
+        if (auto ec = llvm::sys::fs::createTemporaryFile("kscope", "o", object)) {
+            return llvm::createFileError(object, ec);
+        }
+
+        llvm::Error err = emit_native(module, target, llvm::CodeGenFileType::ObjectFile, object);
+        if ( !err ) {
+            err = link_shared_library(object, path);
+        }
+        llvm::sys::fs::remove(object);
+        return err;
+    }
+
+    case EmitKind::IR:
+    case EmitKind::Bitcode: {
+        std::error_code ec;
+        llvm::ToolOutputFile out(path, ec, kind == EmitKind::IR
+                                 ? llvm::sys::fs::OF_Text
+                                 : llvm::sys::fs::OF_None);
+        if ( ec ) {
+            return llvm::createFileError(path, ec);
+        }
+
+        if ( kind == EmitKind::IR ) {
+            module.print(out.os(), nullptr);
+        } else {
+            llvm::WriteBitcodeToFile(module, out.os());
+        }
+        out.keep();
+        return llvm::Error::success();
+    }
+    }
+    return llvm::Error::success();
+}
+
+llvm::Error
+read_signatures(llvm::MemoryBufferRef object,
+                llvm::function_ref<void(llvm::StringRef, unsigned, bool)> define) {
+    auto file = llvm::object::ObjectFile::createObjectFile(object);
+    if ( !file ) { return file.takeError(); }
+
+    for ( const llvm::object::SectionRef &section : (*file)->sections() ) {
+        auto name = section.getName();
+        if ( !name ) { return name.takeError(); }
+        if ( *name != ".kscope_sig" && *name != "__kscope_sig" ) { continue; }
+
+        auto contents = section.getContents();
+        if ( !contents ) { return contents.takeError(); }
+
+        llvm::SmallVector<llvm::StringRef, 64> lines;
+        contents->split(lines, '\n', -1, false);
+        for ( llvm::StringRef line : lines ) {
+            llvm::SmallVector<llvm::StringRef, 3> fields;
+            line.split(fields, ' ', -1, false);
+
+            unsigned arity;
+            bool malformed = fields.size() < 2 || fields.size() > 3
+                || fields[1].getAsInteger(10, arity)
+                || ( fields.size() == 3 && fields[2] != "pure" );
+            if ( malformed ) {
+                return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                               "malformed signature table in %s",
+                                               object.getBufferIdentifier().str().c_str());
+            }
+            define(fields[0], arity, fields.size() == 3);
+        }
+    }
+    return llvm::Error::success();
+}
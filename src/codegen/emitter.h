@@ -0,0 +1,32 @@
+#pragma once
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+
+
+enum class EmitKind {
+    Object,
+    SharedLibrary,
+    Assembly,
+    IR,
+    Bitcode,
+};
+
+/// emit_module - write a module to path ("-" for stdout) ahead of time.
+/// Objects and shared libraries need a position independent target machine;
+/// shared libraries are linked from a temporary object with the system cc.
+/// Native output carries a table of the defined functions and their arity
+/// so it can be loaded back with read_signatures.
+llvm::Error emit_module(llvm::Module &module,
+                        llvm::TargetMachine &target,
+                        EmitKind kind,
+                        llvm::StringRef path);
+
+/// read_signatures - call define for every function listed in the signature
+/// table of an object written by emit_module, with its arity and purity.
+llvm::Error read_signatures(llvm::MemoryBufferRef object,
+                            llvm::function_ref<void(llvm::StringRef, unsigned, bool)> define);
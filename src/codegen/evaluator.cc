@@ -0,0 +1,204 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Type.h"
+
+#include <utility>
+
+#include "evaluator.h"
+
+using ::llvm::BasicBlock;
+using ::llvm::Constant;
+using ::llvm::Function;
+using ::llvm::Instruction;
+using ::llvm::Value;
+
+
+// Recursion in the evaluator is recursion on the native stack
+static const unsigned max_depth = 256;
+
+ConstantEvaluator::ConstantEvaluator(const llvm::DataLayout &data_layout,
+                                     const llvm::Triple &triple,
+                                     bool fp_contract)
+    : data_layout(data_layout),
+      library_info_impl(triple),
+      library_info(library_info_impl),
+      fp_contract(fp_contract) {}
+
+std::optional<double>
+ConstantEvaluator::evaluate(Function &func, uint64_t budget,
+                            llvm::function_ref<Function*(llvm::StringRef)> resolve) {
+    this->resolve = resolve;
+    steps = budget;
+    depth = 0;
+    return run(func, {});
+}
+
+/// may_fuse - whether the backend could compute inst and a multiply that
+/// feeds it as one fused multiply-add.
+static bool
+may_fuse(const Instruction &inst) {
+    if ( inst.getOpcode() != Instruction::FAdd && inst.getOpcode() != Instruction::FSub ) {
+        return false;
+    }
+    for ( auto &use : inst.operands() ) {
+        auto *operand = llvm::dyn_cast<Instruction>(use.get());
+        if ( operand != nullptr && operand->getOpcode() == Instruction::FNeg ) {
+            operand = llvm::dyn_cast<Instruction>(operand->getOperand(0));
+        }
+        if ( operand != nullptr && operand->getOpcode() == Instruction::FMul ) { return true; }
+    }
+    return false;
+}
+
+static std::optional<double>
+to_double(Constant *value) {
+    auto *fp = llvm::dyn_cast_or_null<llvm::ConstantFP>(value);
+    if ( fp == nullptr || !fp->getType()->isDoubleTy() ) { return std::nullopt; }
+    return fp->getValueAPF().convertToDouble();
+}
+
+std::optional<double>
+ConstantEvaluator::run(Function &func, llvm::ArrayRef<double> args) {
+    if ( func.isDeclaration() || func.arg_size() != args.size() || depth == max_depth ) {
+        return std::nullopt;
+    }
+
+    // Values of the instructions run so far, and of the allocas' slots
+    llvm::DenseMap<const Value*, Constant*> values;
+    llvm::DenseMap<const Value*, Constant*> slots;
+    for ( auto &arg : func.args() ) {
+        values[&arg] = llvm::ConstantFP::get(arg.getType(), args[arg.getArgNo()]);
+    }
+
+    auto operand = [&](Value *value) -> Constant* {
+        if ( auto *constant = llvm::dyn_cast<Constant>(value) ) { return constant; }
+        return values.lookup(value);
+    };
+
+    depth++;
+    auto leave = llvm::make_scope_exit([this] { depth--; });
+
+    BasicBlock *block = &func.getEntryBlock();
+    BasicBlock *previous = nullptr;
+    while ( true ) {
+        // Phis read the values from before any of them is assigned
+        llvm::SmallVector<std::pair<llvm::PHINode*, Constant*>, 4> incoming;
+        for ( auto &phi : block->phis() ) {
+            Constant *value = operand(phi.getIncomingValueForBlock(previous));
+            if ( value == nullptr ) { return std::nullopt; }
+            incoming.emplace_back(&phi, value);
+        }
+        for ( auto &entry : incoming ) { values[entry.first] = entry.second; }
+
+        BasicBlock *next = nullptr;
+        for ( Instruction &inst : llvm::make_range(block->getFirstNonPHIIt(), block->end()) ) {
+            if ( steps == 0 ) { return std::nullopt; }
+            steps--;
+
+            if ( auto *ret = llvm::dyn_cast<llvm::ReturnInst>(&inst) ) {
+                if ( ret->getReturnValue() == nullptr ) { return std::nullopt; }
+                return to_double(operand(ret->getReturnValue()));
+            }
+            if ( auto *branch = llvm::dyn_cast<llvm::BranchInst>(&inst) ) {
+                if ( branch->isUnconditional() ) {
+                    next = branch->getSuccessor(0);
+                    break;
+                }
+                auto *condition = llvm::dyn_cast_or_null<llvm::ConstantInt>(
+                    operand(branch->getCondition()));
+                if ( condition == nullptr ) { return std::nullopt; }
+                next = branch->getSuccessor(condition->isOne() ? 0 : 1);
+                break;
+            }
+            if ( llvm::isa<llvm::AllocaInst>(inst) ) {
+                slots[&inst] = nullptr;
+                continue;
+            }
+            if ( auto *load = llvm::dyn_cast<llvm::LoadInst>(&inst) ) {
+                auto slot = slots.find(load->getPointerOperand());
+                if ( slot == slots.end() || slot->second == nullptr || load->isVolatile() ) {
+                    return std::nullopt;
+                }
+                values[&inst] = slot->second;
+                continue;
+            }
+            if ( auto *store = llvm::dyn_cast<llvm::StoreInst>(&inst) ) {
+                auto slot = slots.find(store->getPointerOperand());
+                Constant *value = operand(store->getValueOperand());
+                if ( slot == slots.end() || value == nullptr || store->isVolatile() ) {
+                    return std::nullopt;
+                }
+                slot->second = value;
+                continue;
+            }
+            if ( llvm::isa<llvm::DbgInfoIntrinsic>(inst) || inst.isLifetimeStartOrEnd() ) {
+                continue;
+            }
+
+            llvm::SmallVector<Constant*, 4> operands;
+            for ( auto &use : inst.operands() ) {
+                Constant *value = operand(use.get());
+                if ( value == nullptr ) { return std::nullopt; }
+                operands.push_back(value);
+            }
+
+            if ( auto *call = llvm::dyn_cast<llvm::CallInst>(&inst) ) {
+                Function *callee = call->getCalledFunction();
+                if ( callee == nullptr ) { return std::nullopt; }
+
+                // Fused or not depending on the target
+                if ( callee->getIntrinsicID() == llvm::Intrinsic::fmuladd ) { return std::nullopt; }
+
+                // Intrinsics and libm functions LLVM knows how to fold
+                if ( llvm::canConstantFoldCallTo(call, callee) ) {
+                    Constant *result = llvm::ConstantFoldCall(
+                        call, callee, llvm::ArrayRef<Constant*>(operands).drop_back(),
+                        &library_info);
+                    if ( result == nullptr ) { return std::nullopt; }
+                    values[&inst] = result;
+                    continue;
+                }
+
+                // Other kscope functions, when they cannot have side effects
+                if ( !callee->doesNotAccessMemory() ) { return std::nullopt; }
+                Function *body = callee->isDeclaration() ? resolve(callee->getName()) : callee;
+                if ( body == nullptr ) { return std::nullopt; }
+
+                llvm::SmallVector<double, 4> call_args;
+                for ( auto &arg : call->args() ) {
+                    std::optional<double> value = to_double(operand(arg.get()));
+                    if ( !value ) { return std::nullopt; }
+                    call_args.push_back(*value);
+                }
+                std::optional<double> result = run(*body, call_args);
+                if ( !result ) { return std::nullopt; }
+                values[&inst] = llvm::ConstantFP::get(inst.getType(), *result);
+                continue;
+            }
+
+            if ( inst.mayHaveSideEffects() || inst.mayReadFromMemory() ) { return std::nullopt; }
+            if ( fp_contract && may_fuse(inst) ) { return std::nullopt; }
+            Constant *result;
+            if ( auto *compare = llvm::dyn_cast<llvm::CmpInst>(&inst) ) {
+                result = llvm::ConstantFoldCompareInstOperands(compare->getPredicate(),
+                                                               operands[0], operands[1],
+                                                               data_layout, &library_info);
+            } else {
+                result = llvm::ConstantFoldInstOperands(&inst, operands, data_layout,
+                                                        &library_info);
+            }
+            if ( result == nullptr ) { return std::nullopt; }
+            values[&inst] = result;
+        }
+
+        if ( next == nullptr ) { return std::nullopt; }  // Unreachable, switch, ...
+        previous = block;
+        block = next;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+
+#include <cstdint>
+#include <optional>
+
+
+/// ConstantEvaluator - runs kscope IR at compile time, one instruction at a
+/// time through LLVM's constant folder. Only doubles, their comparisons
+/// and the function's own stack slots are modelled; anything that could be
+/// observed from outside (stores elsewhere, externs that LLVM cannot fold,
+/// calls to functions not known to be pure) ends the evaluation, as does
+/// running out of steps. Nothing has happened by then, so the caller can
+/// still run the code for real. When the backend may contract multiplies
+/// into adds, those adds are left to it too, as the folder would round
+/// twice where the machine rounds once.
+class ConstantEvaluator {
+    const llvm::DataLayout &data_layout;
+    llvm::TargetLibraryInfoImpl library_info_impl;
+    llvm::TargetLibraryInfo library_info;
+    bool fp_contract;
+
+    // For the evaluation in progress
+    llvm::function_ref<llvm::Function*(llvm::StringRef)> resolve;  // Bodies of callees
+    uint64_t steps = 0;
+    unsigned depth = 0;
+
+    std::optional<double> run(llvm::Function &func, llvm::ArrayRef<double> args);
+
+public:
+    ConstantEvaluator(const llvm::DataLayout &data_layout, const llvm::Triple &triple,
+                      bool fp_contract);
+
+    // The value of a function without arguments, if it can be had within
+    // budget instructions
+    std::optional<double> evaluate(llvm::Function &func, uint64_t budget,
+                                   llvm::function_ref<llvm::Function*(llvm::StringRef)> resolve);
+};
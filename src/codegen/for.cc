@@ -7,6 +7,7 @@
 #include "llvm/IR/Type.h"
 
 #include "ast/for.h"
+#include "profile.h"
 #include "renderer.h"
 
 using ::llvm::AllocaInst;
@@ -23,7 +24,7 @@ Value *
 ForNode::codegen(IRRenderer *renderer) {
     Function *func = renderer->builder->GetInsertBlock()->getParent();
 
-    AllocaInst *alloca = renderer->create_entry_block_alloca(func, var_name);
+    AllocaInst *alloca = renderer->create_entry_block_alloca(func, var_name.str());
 
     Value *start_value = start->codegen(renderer);
     if ( start_value == 0 ) { return 0; }
@@ -41,15 +42,25 @@ ForNode::codegen(IRRenderer *renderer) {
     BasicBlock *loop_block = BasicBlock::Create(renderer->module->getContext(), "loop", func);
     BasicBlock *after_block = BasicBlock::Create(renderer->module->getContext(), "afterloop", func);
 
+    LoopProfile *counters = 0;
+    if ( Profile *profile = renderer->profile() ) {
+        counters = profile->begin_loop(var_name.str());
+        Profile::increment(*renderer->builder, &counters->entries, renderer->builder->getInt64(1));
+    }
+
     renderer->builder->CreateBr(loop_block);
     renderer->builder->SetInsertPoint(loop_block);
 
-    AllocaInst *old_value = renderer->get_named_value(var_name);
+    if ( counters != 0 ) {
+        Profile::increment(*renderer->builder, &counters->iterations, renderer->builder->getInt64(1));
+    }
+
+    renderer->push_scope();
     renderer->set_named_value(var_name, alloca);
 
     if ( body->codegen(renderer) == 0 ) { return 0; }
 
-    Value *current_var = renderer->builder->CreateLoad(alloca->getAllocatedType(), alloca, var_name.c_str());
+    Value *current_var = renderer->builder->CreateLoad(alloca->getAllocatedType(), alloca, var_name.str());
     Value *next_var = renderer->builder->CreateFAdd(current_var, step_value, "nextvar");
     renderer->builder->CreateStore(next_var, alloca);
 
@@ -65,11 +76,7 @@ ForNode::codegen(IRRenderer *renderer) {
     renderer->builder->CreateCondBr(loop_condition, loop_block, after_block);
     renderer->builder->SetInsertPoint(after_block);
 
-    if ( old_value ) {
-        renderer->set_named_value(var_name, old_value);
-    } else {
-        renderer->clear_named_value(var_name);
-    }
+    renderer->pop_scope();
 
     return Constant::getNullValue(Type::getDoubleTy(renderer->module->getContext()));
 }
@@ -4,7 +4,9 @@
 #include "llvm/IR/Value.h"
 
 #include "ast/function.h"
+#include "profile.h"
 #include "renderer.h"
+#include "stats.h"
 
 using ::llvm::BasicBlock;
 using ::llvm::Function;
@@ -25,9 +27,29 @@ FunctionNode::codegen(IRRenderer *renderer) {
 
     proto->create_argument_allocas(renderer, func);
 
+    FunctionProfile *counters = 0;
+    Value *entry_cycles = 0;
+    if ( Profile *profile = renderer->profile() ) {
+        counters = profile->begin_function(is_anonymous() ? "(top level)" : func->getName());
+        Profile::increment(*renderer->builder, &counters->calls, renderer->builder->getInt64(1));
+        if ( profile->counts_cycles() ) {
+            entry_cycles = Profile::read_cycles(*renderer->builder);
+        }
+    }
+
     if ( Value *retval = body->codegen(renderer) ) {
+        if ( entry_cycles != 0 ) {
+            Value *spent = renderer->builder->CreateSub(
+                Profile::read_cycles(*renderer->builder), entry_cycles);
+            Profile::increment(*renderer->builder, &counters->cycles, spent);
+        }
         renderer->builder->CreateRet(retval);
-        llvm::verifyFunction(*func);
+        {
+            PhaseTimer timer(renderer->stats(), Phase::Verify);
+            llvm::verifyFunction(*func);
+        }
+        renderer->infer_purity(func);
+        renderer->optimize_function(func);
 
         return func;
     }
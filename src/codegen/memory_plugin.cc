@@ -0,0 +1,91 @@
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/Shared/MemoryFlags.h"
+
+#include "memory_plugin.h"
+
+using ::llvm::orc::MaterializationResponsibility;
+using ::llvm::orc::ResourceKey;
+
+
+JITMemoryUsage
+MemoryUsagePlugin::usage() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return total;
+}
+
+void
+MemoryUsagePlugin::modifyPassConfig(MaterializationResponsibility &MR,
+                                    llvm::jitlink::LinkGraph &,
+                                    llvm::jitlink::PassConfiguration &config) {
+    config.PostAllocationPasses.push_back(
+        [this, &MR](llvm::jitlink::LinkGraph &graph) -> llvm::Error {
+            JITMemoryUsage usage;
+            for ( auto &section : graph.sections() ) {
+                bool code = (section.getMemProt() & llvm::orc::MemProt::Exec) !=
+                    llvm::orc::MemProt::None;
+                for ( auto *block : section.blocks() ) {
+                    (code ? usage.code_bytes : usage.data_bytes) += block->getSize();
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            in_flight[&MR] = usage;
+            return llvm::Error::success();
+        });
+}
+
+llvm::Error
+MemoryUsagePlugin::notifyEmitted(MaterializationResponsibility &MR) {
+    JITMemoryUsage usage;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = in_flight.find(&MR);
+        if ( it == in_flight.end() ) { return llvm::Error::success(); }
+        usage = it->second;
+        in_flight.erase(it);
+    }
+
+    return MR.withResourceKeyDo([&](ResourceKey key) {
+        std::lock_guard<std::mutex> guard(lock);
+        JITMemoryUsage &entry = live[key];
+        entry.code_bytes += usage.code_bytes;
+        entry.data_bytes += usage.data_bytes;
+        total.code_bytes += usage.code_bytes;
+        total.data_bytes += usage.data_bytes;
+    });
+}
+
+llvm::Error
+MemoryUsagePlugin::notifyFailed(MaterializationResponsibility &MR) {
+    std::lock_guard<std::mutex> guard(lock);
+    in_flight.erase(&MR);
+    return llvm::Error::success();
+}
+
+llvm::Error
+MemoryUsagePlugin::notifyRemovingResources(llvm::orc::JITDylib &, ResourceKey key) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = live.find(key);
+    if ( it == live.end() ) { return llvm::Error::success(); }
+
+    total.code_bytes -= it->second.code_bytes;
+    total.data_bytes -= it->second.data_bytes;
+    live.erase(it);
+    return llvm::Error::success();
+}
+
+void
+MemoryUsagePlugin::notifyTransferringResources(llvm::orc::JITDylib &,
+                                               ResourceKey dst_key,
+                                               ResourceKey src_key) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = live.find(src_key);
+    if ( it == live.end() ) { return; }
+
+    JITMemoryUsage usage = it->second;
+    live.erase(it);
+    JITMemoryUsage &entry = live[dst_key];
+    entry.code_bytes += usage.code_bytes;
+    entry.data_bytes += usage.data_bytes;
+}
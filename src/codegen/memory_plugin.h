@@ -0,0 +1,39 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+
+#include <cstddef>
+#include <mutex>
+
+
+struct JITMemoryUsage {
+    size_t code_bytes = 0;  // Executable sections
+    size_t data_bytes = 0;  // Everything else (constants, GOT, ...)
+};
+
+/// MemoryUsagePlugin - keeps a running total of the memory that linked JIT
+/// objects occupy, per resource tracker, so removed trackers are subtracted
+/// again.
+class MemoryUsagePlugin : public llvm::orc::ObjectLinkingLayer::Plugin {
+    mutable std::mutex lock;
+    llvm::DenseMap<llvm::orc::MaterializationResponsibility*, JITMemoryUsage> in_flight;
+    llvm::DenseMap<llvm::orc::ResourceKey, JITMemoryUsage> live;
+    JITMemoryUsage total;
+
+public:
+    JITMemoryUsage usage() const;
+
+    void modifyPassConfig(llvm::orc::MaterializationResponsibility &MR,
+                          llvm::jitlink::LinkGraph &G,
+                          llvm::jitlink::PassConfiguration &config) override;
+    llvm::Error notifyEmitted(llvm::orc::MaterializationResponsibility &MR) override;
+    llvm::Error notifyFailed(llvm::orc::MaterializationResponsibility &MR) override;
+    llvm::Error notifyRemovingResources(llvm::orc::JITDylib &JD,
+                                        llvm::orc::ResourceKey key) override;
+    void notifyTransferringResources(llvm::orc::JITDylib &JD,
+                                     llvm::orc::ResourceKey dst_key,
+                                     llvm::orc::ResourceKey src_key) override;
+};
@@ -0,0 +1,101 @@
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+
+#include "object_cache.h"
+
+
+DiskObjectCache::DiskObjectCache(const std::string &directory,
+                                 const std::string &salt)
+    : directory(directory), salt(salt) {
+    if (auto err = llvm::sys::fs::create_directories(directory)) {
+        llvm::errs() << "Could not create object cache directory '" << directory
+                     << "': " << err.message() << "\n";
+    }
+}
+
+std::string
+DiskObjectCache::key(const llvm::Module *module) const {
+    std::string text;
+    llvm::raw_string_ostream stream(text);
+    stream << salt << '\n';
+    module->print(stream, nullptr);
+    stream.flush();
+
+    llvm::SHA1 hasher;
+    hasher.update(text);
+    return llvm::toHex(hasher.final(), true);
+}
+
+std::string
+DiskObjectCache::path(const std::string &key) const {
+    llvm::SmallString<128> result(directory);
+    llvm::sys::path::append(result, key + ".o");
+    return std::string(result);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+DiskObjectCache::getObject(const llvm::Module *module) {
+    std::string module_key = key(module);
+
+    auto buffer = llvm::MemoryBuffer::getFile(path(module_key),
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if ( buffer ) {
+        return std::move(*buffer);
+    }
+
+    // Remember the key so notifyObjectCompiled does not have to print and
+    // hash the module a second time.
+    std::lock_guard<std::mutex> guard(lock);
+    pending[module] = std::move(module_key);
+    return nullptr;
+}
+
+void
+DiskObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                      llvm::MemoryBufferRef object) {
+    std::string module_key;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = pending.find(module);
+        if ( it != pending.end() ) {
+            module_key = std::move(it->second);
+            pending.erase(it);
+        }
+    }
+    if ( module_key.empty() ) {
+        module_key = key(module);
+    }
+
+    // Write to a private file first so concurrent writers and readers
+    // never observe a partially written object.
+    std::string final_path = path(module_key);
+    llvm::SmallString<128> temp_path;
+    int fd;
+
+    std::error_code err = llvm::sys::fs::createUniqueFile(final_path + ".%%%%%%.tmp",
+                                                          fd,
+                                                          temp_path);
+    if ( err ) {
+        llvm::errs() << "Could not write object cache entry '" << final_path
+                     << "': " << err.message() << "\n";
+        return;
+    }
+
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out << object.getBuffer();
+    }
+
+    if ( (err = llvm::sys::fs::rename(temp_path, final_path)) ) {
+        llvm::sys::fs::remove(temp_path);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+/// DiskObjectCache - content addressed cache of JIT compiled objects.
+///
+/// Objects are stored as <directory>/<sha1>.o where the hash covers the
+/// (already optimized) module IR plus a salt describing the target: triple,
+/// CPU, features and optimization levels. Identical modules compiled for the
+/// same target load their machine code from disk instead of going through
+/// the backend again.
+class DiskObjectCache : public llvm::ObjectCache {
+    std::string directory;
+    std::string salt;
+
+    std::mutex lock;
+    llvm::DenseMap<const llvm::Module*, std::string> pending;
+
+    std::string key(const llvm::Module *module) const;
+    std::string path(const std::string &key) const;
+
+public:
+    DiskObjectCache(const std::string &directory, const std::string &salt);
+
+    void notifyObjectCompiled(const llvm::Module *module,
+                              llvm::MemoryBufferRef object) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+};
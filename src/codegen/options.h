@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+struct RendererOptions {
+    // Optimization level (0-3) used for the IR pass pipelines.
+    unsigned opt_level = 2;
+
+    // Target CPU and comma separated feature list ("+avx2,-avx512f").
+    // Empty values keep what was detected for the host.
+    std::string cpu;
+    std::string features;
+
+    // Callees defined in earlier modules with at most this many instructions
+    // are imported for inlining at opt_level 2 and above; 0 disables it.
+    unsigned import_threshold = 100;
+
+    // Inliner threshold of the module pipeline, -1 keeps the default of
+    // the optimization level.
+    int inline_threshold = -1;
+
+    // Backend optimization level (0-3), -1 follows opt_level.
+    int codegen_opt_level = -1;
+
+    // Allow the backend to fuse multiplies and adds into FMA instructions.
+    bool fp_contract = true;
+
+    // Back the engine with LLLazyJIT so function bodies are compiled (and
+    // optimized) on their first call through a stub.
+    bool lazy = false;
+
+    // Number of background compile threads; 0 compiles on the calling thread.
+    unsigned compile_threads = 0;
+
+    // Directory of the persistent object cache; empty disables it.
+    std::string object_cache_dir;
+
+    // Definitions handed to the JIT per module; 0 groups everything up to
+    // the next top level expression.
+    unsigned batch_size = 0;
+
+    // Steps the constant evaluator may take on a top level expression
+    // before it is compiled and run instead; 0 always runs them.
+    uint64_t fold_budget = 100000;
+
+    // Time the compilation phases and count the size of every function.
+    bool stats = false;
+
+    // Time every pass of the optimization pipelines; reported on exit.
+    bool time_passes = false;
+
+    // Name JIT code for perf: a perf-<pid>.map file and, on ELF hosts,
+    // jitdump records for `perf inject --jit`.
+    bool perf = false;
+
+    // Register linked objects with the GDB JIT interface.
+    bool debugger = false;
+
+    // Instrument generated code with call and loop counters, and with
+    // cycle counts around every call if profile_cycles is set as well.
+    bool profile = false;
+    bool profile_cycles = false;
+
+    // Compile definitions without optimization first and recompile them at
+    // O3, with their branch counts, once called tier_threshold times.
+    // Ignored with lazy.
+    bool tiered = false;
+    unsigned tier_threshold = 1000;
+};
@@ -0,0 +1,115 @@
+#include "llvm/ADT/STLExtras.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "parallel_map.h"
+
+
+static const size_t min_chunk_rows = 1024;
+static const size_t chunks_per_worker = 16;
+
+ParallelMap::ParallelMap(unsigned threads) {
+    workers = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    queues = std::make_unique<Queue[]>(workers);
+
+    // The calling thread is worker 0
+    for ( unsigned i = 1; i < workers; i++ ) {
+        this->threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+ParallelMap::~ParallelMap() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for ( auto &thread : threads ) {
+        thread.join();
+    }
+}
+
+void
+ParallelMap::work(unsigned self) {
+    unsigned seen = 0;
+    while ( true ) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if ( stopping ) { return; }
+            seen = generation;
+        }
+
+        drain(self);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if ( --running == 0 ) {
+            done.notify_one();
+        }
+    }
+}
+
+void
+ParallelMap::drain(unsigned self) {
+    auto bounds = [this](size_t index) {
+        size_t row = index == 0 ? 0 : job.head + (index - 1) * job.chunk;
+        return std::min(row, job.rows);
+    };
+
+    // Own run first, then the others', starting with the next worker so
+    // thieves spread out
+    for ( unsigned i = 0; i < workers; i++ ) {
+        Queue &queue = queues[(self + i) % workers];
+        size_t index;
+        while ( ( index = queue.next.fetch_add(1, std::memory_order_relaxed) ) < queue.end ) {
+            job.slice(bounds(index), bounds(index + 1));
+        }
+    }
+}
+
+void
+ParallelMap::run(size_t rows, const double *out,
+                 llvm::function_ref<void(size_t, size_t)> slice) {
+    if ( rows == 0 ) { return; }
+
+    std::lock_guard<std::mutex> single_caller(running_job);
+    size_t line_rows = cache_line / sizeof(double);
+    size_t chunk = std::max(min_chunk_rows, rows / (workers * chunks_per_worker));
+    chunk = (chunk + line_rows - 1) / line_rows * line_rows;
+
+    // Cut at cache lines of the output; the first chunk takes the rows up
+    // to the first line boundary
+    size_t misalignment = reinterpret_cast<uintptr_t>(out) % cache_line;
+    size_t head = misalignment == 0 ? 0 : (cache_line - misalignment) / sizeof(double);
+    size_t chunks = 1 + (rows > head ? (rows - head + chunk - 1) / chunk : 0);
+
+    if ( workers == 1 || chunks <= 1 ) {
+        slice(0, rows);
+        return;
+    }
+
+    job.slice = slice;
+    job.rows = rows;
+    job.head = head;
+    job.chunk = chunk;
+
+    size_t per_worker = (chunks + workers - 1) / workers;
+    for ( unsigned i = 0; i < workers; i++ ) {
+        queues[i].next.store(std::min(chunks, i * per_worker), std::memory_order_relaxed);
+        queues[i].end = std::min(chunks, (i + 1) * per_worker);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = workers - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return running == 0; });
+}
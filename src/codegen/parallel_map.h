@@ -0,0 +1,87 @@
+#pragma once
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Error.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "array_map.h"
+
+
+/// ParallelMap - runs ArrayMap kernels over large arrays on a pool of
+/// worker threads.
+///
+/// The rows are cut into chunks whose boundaries fall on cache lines of the
+/// output, so no two threads ever write to the same line. Every worker
+/// starts on a contiguous run of chunks of its own and, once that is done,
+/// takes chunks from the front of the other workers' runs.
+///
+/// One map runs at a time: concurrent calls on one pool wait for each
+/// other, as the workers only have room for one job.
+class ParallelMap {
+public:
+    static constexpr size_t cache_line = 64;
+
+private:
+    struct alignas(cache_line) Queue {
+        std::atomic<size_t> next{0};
+        size_t end = 0;
+    };
+
+    struct Job {
+        llvm::function_ref<void(size_t, size_t)> slice;
+        size_t rows = 0;
+        size_t head = 0;   // Rows before the first cache line boundary
+        size_t chunk = 0;  // Rows per chunk after that
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<Queue[]> queues;
+    unsigned workers;
+
+    std::mutex running_job;  // Held by the caller of run throughout
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Job job;
+    unsigned generation = 0;
+    unsigned running = 0;
+    bool stopping = false;
+
+    void work(unsigned self);
+    void drain(unsigned self);
+    void run(size_t rows, const double *out,
+             llvm::function_ref<void(size_t, size_t)> slice);
+
+public:
+    // 0 uses one worker per hardware thread
+    explicit ParallelMap(unsigned threads = 0);
+    ~ParallelMap();
+
+    ParallelMap(const ParallelMap &) = delete;
+    ParallelMap &operator =(const ParallelMap &) = delete;
+
+    unsigned size() const { return workers; }
+
+    /// Apply map to n rows of the input columns. Kernels that may print
+    /// (anything reaching putchard or printd) are refused.
+    template <typename... Columns>
+    llvm::Error operator ()(const ArrayMap &map, double *out, size_t n,
+                            const Columns *...columns) {
+        if ( !map.is_pure() ) {
+            return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                           "kernel has side effects, refusing to run it in parallel");
+        }
+
+        run(n, out, [&](size_t begin, size_t end) {
+            map(out + begin, end - begin, (columns + begin)...);
+        });
+        return llvm::Error::success();
+    }
+};
@@ -0,0 +1,70 @@
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/Shared/MemoryFlags.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+
+#include <string>
+#include <system_error>
+
+#include "perf_map.h"
+
+using ::llvm::orc::MaterializationResponsibility;
+using ::llvm::orc::ResourceKey;
+
+
+PerfMapPlugin::PerfMapPlugin(std::unique_ptr<llvm::raw_fd_ostream> out)
+    : out(std::move(out)) {}
+
+llvm::Expected<std::unique_ptr<PerfMapPlugin>>
+PerfMapPlugin::create() {
+    std::string path = "/tmp/perf-" + std::to_string(llvm::sys::Process::getProcessId()) + ".map";
+
+    std::error_code error;
+    auto out = std::make_unique<llvm::raw_fd_ostream>(path, error, llvm::sys::fs::OF_Append);
+    if ( error ) {
+        return llvm::createFileError(path, error);
+    }
+    return std::unique_ptr<PerfMapPlugin>(new PerfMapPlugin(std::move(out)));
+}
+
+void
+PerfMapPlugin::modifyPassConfig(MaterializationResponsibility &,
+                                llvm::jitlink::LinkGraph &,
+                                llvm::jitlink::PassConfiguration &config) {
+    // Addresses are final once memory is allocated
+    config.PostAllocationPasses.push_back(
+        [this](llvm::jitlink::LinkGraph &graph) -> llvm::Error {
+            std::lock_guard<std::mutex> guard(lock);
+            for ( auto &section : graph.sections() ) {
+                if ( (section.getMemProt() & llvm::orc::MemProt::Exec) ==
+                     llvm::orc::MemProt::None ) {
+                    continue;
+                }
+                for ( auto *symbol : section.symbols() ) {
+                    if ( !symbol->hasName() || symbol->getSize() == 0 ) { continue; }
+
+                    *out << llvm::format("%llx %llx ",
+                                         (unsigned long long)symbol->getAddress().getValue(),
+                                         (unsigned long long)symbol->getSize())
+                         << *symbol->getName() << "\n";
+                }
+            }
+            out->flush();
+            return llvm::Error::success();
+        });
+}
+
+llvm::Error
+PerfMapPlugin::notifyFailed(MaterializationResponsibility &) {
+    return llvm::Error::success();
+}
+
+llvm::Error
+PerfMapPlugin::notifyRemovingResources(llvm::orc::JITDylib &, ResourceKey) {
+    return llvm::Error::success();
+}
+
+void
+PerfMapPlugin::notifyTransferringResources(llvm::orc::JITDylib &, ResourceKey, ResourceKey) {}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <mutex>
+
+
+/// PerfMapPlugin - appends every function the JIT links to
+/// /tmp/perf-<pid>.map, where perf looks up symbols for anonymous
+/// executable memory. Entries are never withdrawn, so addresses reused
+/// after an expression is freed show up under the newest name.
+class PerfMapPlugin : public llvm::orc::ObjectLinkingLayer::Plugin {
+    std::mutex lock;
+    std::unique_ptr<llvm::raw_fd_ostream> out;
+
+    explicit PerfMapPlugin(std::unique_ptr<llvm::raw_fd_ostream> out);
+
+public:
+    static llvm::Expected<std::unique_ptr<PerfMapPlugin>> create();
+
+    void modifyPassConfig(llvm::orc::MaterializationResponsibility &MR,
+                          llvm::jitlink::LinkGraph &G,
+                          llvm::jitlink::PassConfiguration &config) override;
+    llvm::Error notifyFailed(llvm::orc::MaterializationResponsibility &MR) override;
+    llvm::Error notifyRemovingResources(llvm::orc::JITDylib &JD,
+                                        llvm::orc::ResourceKey key) override;
+    void notifyTransferringResources(llvm::orc::JITDylib &JD,
+                                     llvm::orc::ResourceKey dst_key,
+                                     llvm::orc::ResourceKey src_key) override;
+};
@@ -0,0 +1,121 @@
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/Format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "profile.h"
+
+
+Profile::Profile(bool cycles) : cycles(cycles) {}
+
+FunctionProfile *
+Profile::begin_function(llvm::StringRef name) {
+    std::lock_guard<std::mutex> guard(lock);
+    current_function = name.str();
+    next_loop = 0;
+
+    auto &counters = functions[name];
+    if ( !counters ) { counters = std::make_unique<FunctionProfile>(); }
+    return counters.get();
+}
+
+LoopProfile *
+Profile::begin_loop(llvm::StringRef induction_variable) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::string name = current_function + ": for " + induction_variable.str() +
+                       " (" + std::to_string(++next_loop) + ")";
+
+    auto &counters = loops[name];
+    if ( !counters ) { counters = std::make_unique<LoopProfile>(); }
+    return counters.get();
+}
+
+void
+Profile::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    for ( auto &entry : functions ) {
+        entry.getValue()->calls = 0;
+        entry.getValue()->cycles = 0;
+    }
+    for ( auto &entry : loops ) {
+        entry.getValue()->entries = 0;
+        entry.getValue()->iterations = 0;
+    }
+}
+
+void
+Profile::print(llvm::raw_ostream &out, unsigned top) const {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Hottest first: by cycles when they are counted, by calls otherwise
+    std::vector<std::pair<llvm::StringRef, const FunctionProfile*> > hot_functions;
+    uint64_t total_cycles = 0;
+    for ( auto &entry : functions ) {
+        if ( entry.getValue()->calls == 0 ) { continue; }
+        hot_functions.emplace_back(entry.getKey(), entry.getValue().get());
+        total_cycles += entry.getValue()->cycles;
+    }
+    std::sort(hot_functions.begin(), hot_functions.end(), [](const auto &a, const auto &b) {
+        uint64_t a_cost = a.second->cycles ? a.second->cycles.load() : a.second->calls.load();
+        uint64_t b_cost = b.second->cycles ? b.second->cycles.load() : b.second->calls.load();
+        return a_cost != b_cost ? a_cost > b_cost : a.first < b.first;
+    });
+    if ( hot_functions.size() > top ) { hot_functions.resize(top); }
+
+    out << "Functions:\n";
+    if ( cycles ) {
+        out << "           calls           cycles   cycles/call      %  name\n";
+    } else {
+        out << "           calls  name\n";
+    }
+    for ( auto &entry : hot_functions ) {
+        uint64_t calls = entry.second->calls;
+        out << llvm::format("%16llu", (unsigned long long)calls);
+        if ( cycles ) {
+            uint64_t spent = entry.second->cycles;
+            out << llvm::format(" %16llu %13.1f %6.1f", (unsigned long long)spent,
+                                double(spent) / calls,
+                                total_cycles ? 100.0 * spent / total_cycles : 0.0);
+        }
+        out << "  " << entry.first << "\n";
+    }
+
+    std::vector<std::pair<llvm::StringRef, const LoopProfile*> > hot_loops;
+    for ( auto &entry : loops ) {
+        if ( entry.getValue()->entries == 0 ) { continue; }
+        hot_loops.emplace_back(entry.getKey(), entry.getValue().get());
+    }
+    std::sort(hot_loops.begin(), hot_loops.end(), [](const auto &a, const auto &b) {
+        uint64_t a_iterations = a.second->iterations, b_iterations = b.second->iterations;
+        return a_iterations != b_iterations ? a_iterations > b_iterations : a.first < b.first;
+    });
+    if ( hot_loops.size() > top ) { hot_loops.resize(top); }
+
+    out << "Loops:\n";
+    out << "      iterations          entries   trips/entry  name\n";
+    for ( auto &entry : hot_loops ) {
+        uint64_t entries = entry.second->entries, iterations = entry.second->iterations;
+        out << llvm::format("%16llu %16llu %13.1f  ", (unsigned long long)iterations,
+                            (unsigned long long)entries, double(iterations) / entries)
+            << entry.first << "\n";
+    }
+}
+
+llvm::Value *
+Profile::increment(llvm::IRBuilder<> &builder, std::atomic<uint64_t> *counter,
+                   llvm::Value *amount) {
+    // Monotonic: parallel maps may run instrumented code on many threads
+    llvm::Value *address = builder.CreateIntToPtr(
+        builder.getInt64(reinterpret_cast<uintptr_t>(counter)), builder.getPtrTy());
+    return builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, address, amount,
+                                   llvm::MaybeAlign(alignof(std::atomic<uint64_t>)),
+                                   llvm::AtomicOrdering::Monotonic);
+}
+
+llvm::Value *
+Profile::read_cycles(llvm::IRBuilder<> &builder) {
+    return builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {});
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Value.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+struct FunctionProfile {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> cycles{0};  // Inclusive, so recursion counts at every level
+};
+
+struct LoopProfile {
+    std::atomic<uint64_t> entries{0};
+    std::atomic<uint64_t> iterations{0};
+};
+
+/// Profile - counters that instrumented code updates in place: calls and
+/// cycles per function, entries and iterations per `for` loop. Generated
+/// code holds their addresses, so counters live as long as the profile and
+/// survive redefinitions of their function.
+class Profile {
+    bool cycles;
+    mutable std::mutex lock;
+    llvm::StringMap<std::unique_ptr<FunctionProfile> > functions;
+    llvm::StringMap<std::unique_ptr<LoopProfile> > loops;  // "function: for i (2)"
+
+    std::string current_function;
+    unsigned next_loop = 0;
+
+public:
+    explicit Profile(bool cycles);
+
+    bool counts_cycles() const { return cycles; }
+
+    // Counters of the function being generated, and of its next loop
+    FunctionProfile *begin_function(llvm::StringRef name);
+    LoopProfile *begin_loop(llvm::StringRef induction_variable);
+
+    void reset();
+    void print(llvm::raw_ostream &out, unsigned top) const;
+
+    // Code to add to a counter, yielding its previous value, and to read
+    // the cycle counter
+    static llvm::Value *increment(llvm::IRBuilder<> &builder, std::atomic<uint64_t> *counter,
+                                  llvm::Value *amount);
+    static llvm::Value *read_cycles(llvm::IRBuilder<> &builder);
+};
@@ -22,7 +22,7 @@ PrototypeNode::create_argument_allocas(IRRenderer *renderer, Function *func) {
     Function::arg_iterator iterator = func->arg_begin();
     for ( auto &arg : args) {
         Value *val = iterator++;
-        AllocaInst *alloca = renderer->create_entry_block_alloca(func, arg);
+        AllocaInst *alloca = renderer->create_entry_block_alloca(func, arg.str());
         renderer->builder->CreateStore(val, alloca);
         renderer->set_named_value(arg, alloca);
     }
@@ -30,21 +30,16 @@ PrototypeNode::create_argument_allocas(IRRenderer *renderer, Function *func) {
 
 Function *
 PrototypeNode::codegen(IRRenderer *renderer) {
-    std::vector<Type*> doubles(args.size(),
-                               Type::getDoubleTy(renderer->llvm_context()));
-    FunctionType *func_type = FunctionType::get(
-                                                Type::getDoubleTy(renderer->llvm_context()),
-                                                doubles,
-                                                false);
+    FunctionType *func_type = renderer->function_type(args.size());
 
     Function *func = Function::Create(func_type,
                                       Function::ExternalLinkage,
-                                      name,
+                                      name.str(),
                                       renderer->module.get());
 
-    if ( func->getName() != name ) {
+    if ( func->getName() != name.str() ) {
         func->eraseFromParent();
-        func = renderer->module->getFunction(name);
+        func = renderer->module->getFunction(name.str());
 
         if ( !func->empty() ) {
             ErrorF("redefinition of function");
@@ -59,11 +54,11 @@ PrototypeNode::codegen(IRRenderer *renderer) {
     Function::arg_iterator iterator = func->arg_begin();
     for ( auto &arg : args ) {
         Value *val = iterator++;
-        val->setName(arg);
+        val->setName(arg.str());
     }
 
     // Record the function type for later use
-    renderer->add_function_type(name, func_type);
+    renderer->add_function_type(name.str(), func_type);
 
     return func;
 }
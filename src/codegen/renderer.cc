@@ -1,3 +1,9 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/DataLayout.h"
@@ -7,14 +13,28 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetSelect.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SROA.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
 
+#include <optional>
 #include <string>
 #include <cstdlib>
 
+#include "emitter.h"
 #include "renderer.h"
+#include "stats.h"
 
 using ::llvm::AllocaInst;
 using ::llvm::Function;
@@ -25,78 +45,312 @@ using ::llvm::Type;
 using ::llvm::orc::LLJIT;
 
 
-IRRenderer::IRRenderer() {
-    context = std::make_unique<LLVMContext>();
-    module = std::make_unique<Module>("my cool jit", *context);
-    builder = std::make_unique<IRBuilder<>>(*context);
+IRRenderer::IRRenderer() : IRRenderer(RendererOptions()) {}
 
-    auto jit_builder = llvm::orc::LLJITBuilder();
-    auto initResult = jit_builder.create();
-    if (auto err = initResult.takeError()) {
-        llvm::errs() << "Could not create LLJIT: " << err << "\n";
-        exit(1);
-    }
+IRRenderer::IRRenderer(const RendererOptions &options)
+    : IRRenderer(JITRuntime::create(options)) {}
 
-    engine = std::move(initResult.get());
+IRRenderer::IRRenderer(std::shared_ptr<JITRuntime> runtime)
+    : options(runtime->options()), runtime(std::move(runtime)) {
+    create_session();
+    context = llvm::orc::ThreadSafeContext(std::make_unique<LLVMContext>());
+    reset_module();
+    create_pass_pipelines();
 }
 
 IRRenderer::IRRenderer(const IRRenderer &other)
-    : IRRenderer(llvm::CloneModule(*other.module).release()) {}
+    : IRRenderer(other.runtime, llvm::CloneModule(*other.module).release()) {}
 
-IRRenderer::IRRenderer(Module *module)
-    : context(std::make_unique<LLVMContext>()),
+IRRenderer::IRRenderer(std::shared_ptr<JITRuntime> runtime, Module *module)
+    : options(runtime->options()),
+      runtime(std::move(runtime)),
+      context(std::make_unique<LLVMContext>()),
       module(std::unique_ptr<Module>(module)),
-      builder(std::make_unique<IRBuilder<>>(*context)) {
-
-    auto jit_builder = llvm::orc::LLJITBuilder();
-    auto initResult = jit_builder.create();
-    if (auto err = initResult.takeError()) {
-        llvm::errs() << "Could not create LLJIT: " << err << "\n";
-        exit(1);
-    }
-
-    engine = std::move(initResult.get());
+      builder(std::make_unique<IRBuilder<>>(*context.getContext())) {
+    create_session();
+    create_pass_pipelines();
 }
 
 IRRenderer::IRRenderer(IRRenderer &&other) {
+    options = other.options;
+    runtime = std::move(other.runtime);
+    target_machine = std::move(other.target_machine);
     context = std::move(other.context);
     module = std::move(other.module);
-    engine = std::move(other.engine);
+    engine = other.engine;
+    lazy_engine = other.lazy_engine;
+    session_dylib = other.session_dylib;
+    anon_dylib = other.anon_dylib;
+    other.session_dylib = nullptr;
+    if ( session_dylib ) {
+        runtime->move_session(*session_dylib, this);
+    }
+    context_modules = other.context_modules;
+    library = std::move(other.library);
+    array_maps = std::move(other.array_maps);
+    profile_data = std::move(other.profile_data);
+    tiers = std::move(other.tiers);
+    if ( tiers ) { tiers->rebind(this); }
+    evaluator = std::move(other.evaluator);
+    fold_context = std::move(other.fold_context);
+    fold_modules = std::move(other.fold_modules);
+    fold_bodies = std::move(other.fold_bodies);
     builder = std::move(other.builder);
+    loop_analyses = std::move(other.loop_analyses);
+    function_analyses = std::move(other.function_analyses);
+    cgscc_analyses = std::move(other.cgscc_analyses);
+    module_analyses = std::move(other.module_analyses);
+    pass_callbacks = std::move(other.pass_callbacks);
+    pass_timers = std::move(other.pass_timers);
+    pass_builder = std::move(other.pass_builder);
+    function_passes = std::move(other.function_passes);
+    module_passes = std::move(other.module_passes);
 }
 
 IRRenderer &
 IRRenderer::operator =(IRRenderer other) {
+    std::swap(options, other.options);
+    std::swap(runtime, other.runtime);
+    std::swap(target_machine, other.target_machine);
     std::swap(context, other.context);
     std::swap(module, other.module);
     std::swap(engine, other.engine);
+    std::swap(lazy_engine, other.lazy_engine);
+    std::swap(session_dylib, other.session_dylib);
+    std::swap(anon_dylib, other.anon_dylib);
+    std::swap(context_modules, other.context_modules);
+    std::swap(library, other.library);
+    std::swap(array_maps, other.array_maps);
+    std::swap(profile_data, other.profile_data);
+    std::swap(tiers, other.tiers);
+    if ( tiers ) { tiers->rebind(this); }
+    if ( other.tiers ) { other.tiers->rebind(&other); }
+    std::swap(evaluator, other.evaluator);
+    std::swap(fold_context, other.fold_context);
+    std::swap(fold_modules, other.fold_modules);
+    std::swap(fold_bodies, other.fold_bodies);
     std::swap(builder, other.builder);
+    std::swap(loop_analyses, other.loop_analyses);
+    std::swap(function_analyses, other.function_analyses);
+    std::swap(cgscc_analyses, other.cgscc_analyses);
+    std::swap(module_analyses, other.module_analyses);
+    std::swap(pass_callbacks, other.pass_callbacks);
+    std::swap(pass_timers, other.pass_timers);
+    std::swap(pass_builder, other.pass_builder);
+    std::swap(function_passes, other.function_passes);
+    std::swap(module_passes, other.module_passes);
+    if ( session_dylib ) {
+        runtime->move_session(*session_dylib, this);
+    }
+    if ( other.session_dylib ) {
+        other.runtime->move_session(*other.session_dylib, &other);
+    }
     return *this;
 }
 
 IRRenderer::~IRRenderer() {
+    // Close the session first; it waits for partitions still being optimized
+    // with the pipelines below. A promotion in progress is finished before.
+    if ( tiers ) { tiers->stop(); }
+    if ( session_dylib ) {
+        runtime->close_session(*session_dylib);
+    }
+    tiers.reset();  // Owns the stubs
+    module_passes.reset();
+    function_passes.reset();
+    module_analyses.reset();
+    cgscc_analyses.reset();
+    function_analyses.reset();
+    loop_analyses.reset();
+    pass_builder.reset();
+    pass_timers.reset();  // Prints the report
+    pass_callbacks.reset();
     builder.reset();
-    engine.reset();
     module.reset();
-    context.reset();
+    context = llvm::orc::ThreadSafeContext();
+    target_machine.reset();
+}
+
+void
+IRRenderer::create_session() {
+    engine = &runtime->engine();
+    lazy_engine = runtime->lazy_engine();
+
+    if ( options.profile ) {
+        profile_data = std::make_unique<Profile>(options.profile_cycles);
+    }
+
+    // The pass pipelines need their own TargetMachine for cost modelling
+    // (vectorizer widths, FMA availability) of the same host target.
+    auto tm = runtime->target_machine_builder().createTargetMachine();
+    if (auto err = tm.takeError()) {
+        llvm::errs() << "Could not create target machine: " << err << "\n";
+        exit(1);
+    }
+    target_machine = std::move(*tm);
+
+    auto session = runtime->open_session(this);
+    if (auto err = session.takeError()) {
+        llvm::errs() << "Could not create JITDylib: " << err << "\n";
+        exit(1);
+    }
+    session_dylib = &*session;
+
+    // Anonymous expressions are emitted into their own dylib, which resolves
+    // against the session (and through it the prelude) first and is emptied
+    // after every evaluation.
+    auto anon = engine->createJITDylib(session_dylib->getName() + ".anon");
+    if (auto err = anon.takeError()) {
+        llvm::errs() << "Could not create JITDylib: " << err << "\n";
+        exit(1);
+    }
+    anon_dylib = &*anon;
+
+    llvm::orc::JITDylibSearchOrder link_order = {
+        {session_dylib, llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly}
+    };
+    session_dylib->withLinkOrderDo([&](const llvm::orc::JITDylibSearchOrder &order) {
+        link_order.insert(link_order.end(), order.begin(), order.end());
+    });
+    anon_dylib->setLinkOrder(std::move(link_order));
+
+    if ( options.tiered && !lazy_engine ) {
+        tiers = std::make_unique<TierManager>(this, *engine, options.tier_threshold);
+    }
+}
+
+void
+IRRenderer::create_pass_pipelines() {
+    loop_analyses = std::make_unique<llvm::LoopAnalysisManager>();
+    function_analyses = std::make_unique<llvm::FunctionAnalysisManager>();
+    cgscc_analyses = std::make_unique<llvm::CGSCCAnalysisManager>();
+    module_analyses = std::make_unique<llvm::ModuleAnalysisManager>();
+    if ( options.time_passes && !pass_timers ) {
+        pass_callbacks = std::make_unique<llvm::PassInstrumentationCallbacks>();
+        pass_timers = std::make_unique<llvm::TimePassesHandler>(true);
+        pass_timers->registerCallbacks(*pass_callbacks);
+    }
+    llvm::PipelineTuningOptions tuning;
+    if ( options.inline_threshold >= 0 ) {
+        tuning.InlinerThreshold = options.inline_threshold;
+    }
+    pass_builder = std::make_unique<llvm::PassBuilder>(
+        target_machine.get(), tuning, std::nullopt,
+        pass_callbacks.get());
+
+    pass_builder->registerModuleAnalyses(*module_analyses);
+    pass_builder->registerCGSCCAnalyses(*cgscc_analyses);
+    pass_builder->registerFunctionAnalyses(*function_analyses);
+    pass_builder->registerLoopAnalyses(*loop_analyses);
+    pass_builder->crossRegisterProxies(*loop_analyses,
+                                       *function_analyses,
+                                       *cgscc_analyses,
+                                       *module_analyses);
+
+    function_passes = std::make_unique<llvm::FunctionPassManager>();
+    module_passes.reset();
+
+    if ( options.opt_level == 0 ) { return; }
+
+    // Promote the allocas created for arguments, `var` and `for` bindings
+    // to SSA values, then clean up the arithmetic and control flow.
+    function_passes->addPass(llvm::PromotePass());
+    function_passes->addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG));
+    function_passes->addPass(llvm::InstCombinePass());
+    function_passes->addPass(llvm::ReassociatePass());
+    function_passes->addPass(llvm::GVNPass());
+    function_passes->addPass(llvm::SimplifyCFGPass());
+
+    if ( options.opt_level < 2 ) { return; }
+
+    llvm::OptimizationLevel level = options.opt_level >= 3
+        ? llvm::OptimizationLevel::O3
+        : llvm::OptimizationLevel::O2;
+
+    module_passes = std::make_unique<llvm::ModulePassManager>(
+        pass_builder->buildPerModuleDefaultPipeline(level));
+}
+
+void
+IRRenderer::clear_analyses() {
+    // Cached results refer to IR that is about to be handed to the JIT.
+    loop_analyses->clear();
+    function_analyses->clear();
+    cgscc_analyses->clear();
+    module_analyses->clear();
 }
 
 llvm::LLVMContext &
-IRRenderer::llvm_context() { return *context; }
+IRRenderer::llvm_context() { return *context.getContext(); }
+
+// Modules share one context instead of paying for a new one per expression.
+// Uniqued constants and types are never freed while a context lives, so a
+// fresh context is started every so often; the previous one is released
+// together with the last module the JIT still holds in it.
+static const unsigned modules_per_context = 1024;
+
+void
+IRRenderer::reset_module() {
+    if ( context_modules++ == modules_per_context ) {
+        context = llvm::orc::ThreadSafeContext(std::make_unique<LLVMContext>());
+        context_modules = 1;
+        function_types.clear();
+        builder.reset();
+    }
+
+    module = std::make_unique<Module>("my cool jit", llvm_context());
+    module->setDataLayout(engine->getDataLayout());
+    module->setTargetTriple(engine->getTargetTriple().str());
+    if ( !builder ) {
+        builder = std::make_unique<IRBuilder<>>(llvm_context());
+    }
+}
+
+/// detach_module - the module generated so far, for the caller alone; its
+/// definitions are not handed to the JIT. It lives in the current context.
+unique_ptr<Module>
+IRRenderer::detach_module() {
+    unique_ptr<Module> detached = std::move(module);
+    reset_module();
+    return detached;
+}
+
+bool
+IRRenderer::has_definitions() {
+    for ( auto &func : *module ) {
+        if ( !func.isDeclaration() ) { return true; }
+    }
+    return false;
+}
+
+llvm::orc::ThreadSafeModule
+IRRenderer::take_module() {
+    // Collect function types before moving module
+    reset_function_types();
+
+    llvm::orc::ThreadSafeModule tsm(std::move(module), context);
+    reset_module();
+    return tsm;
+}
 
 llvm::AllocaInst *
-IRRenderer::get_named_value (const std::string &name){
-    return named_values[name];
+IRRenderer::get_named_value(Identifier name) {
+    return named_values.lookup(name);
 }
 
 void
-IRRenderer::set_named_value(const std::string &name, llvm::AllocaInst *value) {
-    named_values[name] = value;
+IRRenderer::set_named_value(Identifier name, llvm::AllocaInst *value) {
+    named_values.bind(name, value);
 }
 
 void
-IRRenderer::clear_named_value(const std::string &name) {
-    named_values.erase(name);
+IRRenderer::push_scope() {
+    named_values.push_scope();
+}
+
+void
+IRRenderer::pop_scope() {
+    named_values.pop_scope();
 }
 
 void
@@ -105,87 +359,579 @@ IRRenderer::clear_all_named_values() {
 }
 
 AllocaInst *
-IRRenderer::create_entry_block_alloca(Function *func, const std::string &name) {
+IRRenderer::create_entry_block_alloca(Function *func, llvm::StringRef name) {
     IRBuilder<> tmp_builder(&func->getEntryBlock(),
                             func->getEntryBlock().begin());
 
     return tmp_builder.CreateAlloca(Type::getDoubleTy(module->getContext()),
                                     0,
-                                    name.c_str());
+                                    name);
 }
 
 void
 IRRenderer::declare_external_function(const std::string &name) {
-    // Create function type for a function that takes a double and returns a double
-    std::vector<Type*> param_types = {Type::getDoubleTy(module->getContext())};
-    llvm::FunctionType *func_type = llvm::FunctionType::get(
-        Type::getDoubleTy(module->getContext()),
-        param_types,
-        false
-    );
+    // Externals take a double and return a double; the declaration is
+    // emitted by get_function in whichever module first calls them.
+    signatures.declare(name, 1);
+}
 
-    // Create or get the function with ExternalLinkage (external function)
-    Function::Create(
-        func_type,
-        Function::ExternalLinkage,
-        name,
-        module.get()
-    );
+llvm::FunctionType *
+IRRenderer::function_type(unsigned arity) {
+    if ( arity >= function_types.size() ) {
+        function_types.resize(arity + 1, nullptr);
+    }
+
+    llvm::FunctionType *&type = function_types[arity];
+    if ( type == nullptr ) {
+        // Assume all parameters are doubles and return type is double
+        Type *double_type = Type::getDoubleTy(llvm_context());
+        std::vector<Type*> param_types(arity, double_type);
+        type = llvm::FunctionType::get(double_type, param_types, false);
+    }
+    return type;
 }
 
 Function *
-IRRenderer::get_function(const std::string &name) {
+IRRenderer::get_function(llvm::StringRef name) {
     // First, try to find the function in the current module
     Function *func = module->getFunction(name);
     if (func != nullptr) {
         return func;
     }
 
-    // If not found in the module, try to find it in the JIT
-    auto sym = engine->lookup(name);
-    if (sym) {
-        // Found in JIT, create a declaration in the current module
-        // Use the stored argument count if available
-        auto it = function_arg_counts.find(name);
-        if (it == function_arg_counts.end()) {
-            // If we don't have argument count information, we can't create the declaration
-            return nullptr;
-        }
-
-        int arg_count = it->second;
+    // Otherwise it must be a known prototype, possibly compiled in an
+    // earlier module or the prelude; create a declaration in the current module
+    std::optional<Signature> signature = this->signature(name);
+    if (!signature) {
+        return nullptr;
+    }
 
-        // Create the function type in the current context
-        // Assume all parameters are doubles and return type is double
-        std::vector<Type*> param_types(arg_count, Type::getDoubleTy(module->getContext()));
-        llvm::FunctionType *func_type = llvm::FunctionType::get(
-            Type::getDoubleTy(module->getContext()),
-            param_types,
-            false
-        );
-
-        func = Function::Create(
-            func_type,
-            Function::ExternalLinkage,
-            name,
-            module.get()
-        );
-        return func;
+    func = Function::Create(
+        function_type(signature->arity),
+        Function::ExternalLinkage,
+        name,
+        module.get()
+    );
+    if ( signature->pure ) {
+        func->setDoesNotAccessMemory();
     }
+    return func;
+}
 
-    return nullptr;
+// Top level expressions are only called once, from evaluate, and must not
+// grow the signature table by one entry each
+static bool
+is_anonymous(llvm::StringRef name) {
+    return name.starts_with("__anon_expr");
 }
 
 void
-IRRenderer::add_function_type(const std::string &name, llvm::FunctionType *type) {
-    function_arg_counts[name] = type->getNumParams();
+IRRenderer::add_function_type(llvm::StringRef name, llvm::FunctionType *type) {
+    if ( is_anonymous(name) ) { return; }
+    signatures.declare(name, type->getNumParams());
+}
+
+std::optional<Signature>
+IRRenderer::signature(llvm::StringRef name) const {
+    if ( const Signature *own = signatures.find(name) ) {
+        return *own;
+    }
+    return runtime->prelude_signature(name);
 }
 
 void
 IRRenderer::reset_function_types() {
-    // Collect function argument counts from the current module
+    // Mark the functions with bodies in the current module as defined
     for (auto &func : *module) {
-        if (!func.isDeclaration()) {
-            function_arg_counts[func.getName().str()] = func.arg_size();
+        if (!func.isDeclaration() && !is_anonymous(func.getName())) {
+            signatures.define(func.getName(), func.arg_size(), func.doesNotAccessMemory());
+        }
+    }
+}
+
+void
+IRRenderer::infer_purity(Function *func) {
+    // Externs may do anything; kscope code itself only touches its own
+    // stack slots, so a function is pure when everything it calls is.
+    // Instrumented code writes its counters and is never pure.
+    if ( profile_data ) { return; }
+
+    for ( auto &block : *func ) {
+        for ( auto &inst : block ) {
+            auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+            if ( call == 0 ) { continue; }
+
+            Function *callee = call->getCalledFunction();
+            if ( callee == func || ( callee != 0 && callee->isIntrinsic() ) ) { continue; }
+            if ( callee == 0 || !callee->doesNotAccessMemory() ) { return; }
+        }
+    }
+    func->setDoesNotAccessMemory();
+}
+
+void
+IRRenderer::optimize_function(Function *func) {
+    // Tier 0 code is left as it is
+    if ( options.opt_level == 0 || tiers ) { return; }
+
+    PhaseTimer timer(runtime->stats(), Phase::Optimize);
+    std::lock_guard<std::mutex> lock(optimizer_mutex);
+    function_passes->run(*func, *function_analyses);
+    clear_analyses();
+}
+
+void
+IRRenderer::optimize_module(Module &target) {
+    CompileStats *stats = runtime->stats();
+    if ( module_passes ) {
+        PhaseTimer timer(stats, Phase::Optimize);
+        std::lock_guard<std::mutex> lock(optimizer_mutex);
+        module_passes->run(target, *module_analyses);
+        clear_analyses();
+    }
+    if ( stats ) { stats->record_module(target); }
+}
+
+/// retain_definitions - the bitcode of a module about to be handed to the
+/// JIT; it joins the library with keep_definitions once the JIT took it.
+llvm::StringMap<IRRenderer::RetainedDefinition>
+IRRenderer::retain_definitions(Module &source) {
+    auto bitcode = std::make_shared<llvm::SmallVector<char, 0> >();
+    llvm::raw_svector_ostream stream(*bitcode);
+    llvm::WriteBitcodeToFile(source, stream);
+
+    llvm::StringMap<RetainedDefinition> retained;
+    for ( auto &func : source ) {
+        if ( !func.isDeclaration() ) {
+            retained[func.getName()] = {bitcode, func.getInstructionCount()};
+        }
+    }
+    return retained;
+}
+
+void
+IRRenderer::keep_definitions(llvm::StringMap<RetainedDefinition> retained) {
+    std::lock_guard<std::mutex> lock(library_mutex);
+    for ( auto &entry : retained ) {
+        library[entry.getKey()] = std::move(entry.getValue());
+    }
+}
+
+llvm::Error
+IRRenderer::import_definition(Module &dest, llvm::StringRef name, unsigned max_instructions) {
+    std::shared_ptr<const llvm::SmallVector<char, 0> > retained;
+    {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        auto found = library.find(name);
+        if ( found == library.end() ) {
+            // Loaded from an object; calls simply go through the JIT
+            return llvm::Error::success();
         }
+        retained = found->second.bitcode;
     }
+
+    const llvm::SmallVector<char, 0> &bitcode = *retained;
+    llvm::MemoryBufferRef buffer(llvm::StringRef(bitcode.data(), bitcode.size()), name);
+    auto source = llvm::parseBitcodeFile(buffer, dest.getContext());
+    if ( !source ) { return source.takeError(); }
+
+    // The JIT keeps the real definitions, these are only for the inliner.
+    // Whatever they call from the same module comes along, unless too big.
+    for ( auto &func : **source ) {
+        if ( func.isDeclaration() ) { continue; }
+
+        if ( func.getInstructionCount() > max_instructions && func.getName() != name ) {
+            func.deleteBody();
+        } else {
+            func.setLinkage(Function::AvailableExternallyLinkage);
+        }
+    }
+
+    if ( llvm::Linker::linkModules(dest, std::move(*source),
+                                   llvm::Linker::Flags::LinkOnlyNeeded) ) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "could not import %s", name.str().c_str());
+    }
+    return llvm::Error::success();
+}
+
+/// import_callees - bring in the small functions that target calls from
+/// earlier modules, like ThinLTO's function import. Only the module
+/// pipeline inlines them and drops the copies again.
+llvm::Error
+IRRenderer::import_callees(Module &target) {
+    if ( !module_passes || options.import_threshold == 0 ) { return llvm::Error::success(); }
+
+    std::vector<std::string> imports;
+    {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        for ( auto &func : target ) {
+            if ( !func.isDeclaration() || func.isIntrinsic() ) { continue; }
+
+            auto found = library.find(func.getName());
+            if ( found != library.end()
+                 && found->second.instructions <= options.import_threshold ) {
+                imports.push_back(func.getName().str());
+            }
+        }
+    }
+
+    for ( auto &name : imports ) {
+        // Already there when defined next to an earlier import
+        Function *func = target.getFunction(name);
+        if ( func != nullptr && !func->isDeclaration() ) { continue; }
+
+        if (auto err = import_definition(target, name, options.import_threshold)) { return err; }
+    }
+    return llvm::Error::success();
+}
+
+llvm::Error
+IRRenderer::add_module(llvm::orc::ThreadSafeModule tsm) {
+    PhaseTimer timer(runtime->stats(), Phase::AddModule);
+
+    // Rejected modules (duplicate definitions, ...) are not retained, so
+    // imports and folding only ever see what the JIT runs
+    llvm::StringMap<RetainedDefinition> retained;
+
+    if ( lazy_engine ) {
+        tsm.withModuleDo([&](Module &m) { retained = retain_definitions(m); });
+        if (auto err = lazy_engine->addLazyIRModule(*session_dylib, std::move(tsm))) { return err; }
+        keep_definitions(std::move(retained));
+        return llvm::Error::success();
+    }
+
+    if ( tiers ) {
+        tsm.withModuleDo([&](Module &m) { retained = retain_definitions(m); });
+
+        // Callers, in this module or later ones, find the stubs; the stubs
+        // find the unoptimized bodies
+        std::vector<std::string> names;
+        tsm.withModuleDo([&](Module &m) { names = tiers->instrument(m); });
+        if (auto err = tiers->create_stubs(*session_dylib, names)) { return err; }
+        if (auto err = engine->addIRModule(*session_dylib, std::move(tsm))) { return err; }
+        keep_definitions(std::move(retained));
+
+        for ( auto &name : names ) {
+            auto body = lookup(name + ".tier0");
+            if ( !body ) { return body.takeError(); }
+            if (auto err = tiers->redirect(name, *body)) { return err; }
+        }
+        return llvm::Error::success();
+    }
+
+    // Retained after optimization, so later imports start out simplified
+    auto err = tsm.withModuleDo([&](Module &m) -> llvm::Error {
+        if (auto err = import_callees(m)) { return err; }
+        optimize_module(m);
+        retained = retain_definitions(m);
+        return llvm::Error::success();
+    });
+    if ( err ) { return err; }
+    if (auto err = engine->addIRModule(*session_dylib, std::move(tsm))) { return err; }
+    keep_definitions(std::move(retained));
+    return llvm::Error::success();
+}
+
+llvm::Error
+IRRenderer::flush_definitions() {
+    if ( !has_definitions() ) { return llvm::Error::success(); }
+
+    return add_module(take_module());
+}
+
+/// promote - runs on the tiering thread, in a context of its own. The body
+/// comes from the retained bitcode, so it carries none of the counters.
+llvm::Error
+IRRenderer::promote(FunctionTier &tier) {
+    auto tier_context = std::make_unique<LLVMContext>();
+    auto tier_module = std::make_unique<Module>(tier.name + ".tier1", *tier_context);
+    tier_module->setDataLayout(engine->getDataLayout());
+    tier_module->setTargetTriple(engine->getTargetTriple().str());
+
+    Type *double_type = Type::getDoubleTy(*tier_context);
+    std::vector<Type*> param_types(tier.arity, double_type);
+    Function::Create(llvm::FunctionType::get(double_type, param_types, false),
+                     Function::ExternalLinkage, tier.name, tier_module.get());
+    if (auto err = import_definition(*tier_module, tier.name)) { return err; }
+
+    Function *func = tier_module->getFunction(tier.name);
+    if ( func == nullptr || func->isDeclaration() ) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "no IR for %s", tier.name.c_str());
+    }
+    func->setLinkage(Function::ExternalLinkage);
+
+    // Callees defined in other modules, so they can be inlined as well
+    std::vector<std::string> callees;
+    for ( auto &other : *tier_module ) {
+        if ( other.isDeclaration() && !other.isIntrinsic() ) {
+            callees.push_back(other.getName().str());
+        }
+    }
+    for ( auto &callee : callees ) {
+        if (auto err = import_definition(*tier_module, callee)) { return err; }
+    }
+
+    tiers->annotate(*func, tier);
+    func->setName(tier.name + ".tier1");
+    {
+        PhaseTimer timer(runtime->stats(), Phase::Optimize);
+        std::lock_guard<std::mutex> optimizer_lock(optimizer_mutex);
+        llvm::ModulePassManager passes =
+            pass_builder->buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+        passes.run(*tier_module, *module_analyses);
+        clear_analyses();
+    }
+    if ( CompileStats *stats = runtime->stats() ) { stats->record_module(*tier_module); }
+
+    llvm::orc::ThreadSafeModule tsm(std::move(tier_module),
+                                    llvm::orc::ThreadSafeContext(std::move(tier_context)));
+    if (auto err = engine->addIRModule(*session_dylib, std::move(tsm))) { return err; }
+
+    auto body = lookup(tier.name + ".tier1");
+    if ( !body ) { return body.takeError(); }
+    return tiers->redirect(tier.name, *body);
+}
+
+Function *
+IRRenderer::fold_body(llvm::StringRef name) {
+    auto cached = fold_bodies.find(name);
+    if ( cached != fold_bodies.end() ) { return cached->second; }
+
+    std::shared_ptr<const llvm::SmallVector<char, 0> > retained;
+    {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        auto found = library.find(name);
+        if ( found == library.end() ) { return nullptr; }
+        retained = found->second.bitcode;
+    }
+
+    if ( !fold_context ) {
+        fold_context = std::make_unique<LLVMContext>();
+    }
+    llvm::MemoryBufferRef buffer(llvm::StringRef(retained->data(), retained->size()), name);
+    auto parsed = llvm::parseBitcodeFile(buffer, *fold_context);
+    if ( !parsed ) {
+        llvm::consumeError(parsed.takeError());
+        return nullptr;
+    }
+
+    for ( auto &func : **parsed ) {
+        if ( !func.isDeclaration() ) { fold_bodies[func.getName()] = &func; }
+    }
+    fold_modules.push_back(std::move(*parsed));
+    return fold_bodies.lookup(name);
+}
+
+/// fold_expression - the value of an anonymous expression, if it can be
+/// computed without running it: no side effects, only pure callees with
+/// retained IR, within options.fold_budget steps. The function is then
+/// removed from the module.
+std::optional<double>
+IRRenderer::fold_expression(Function &func) {
+    if ( options.fold_budget == 0 ) { return std::nullopt; }
+
+    PhaseTimer timer(runtime->stats(), Phase::Execute);
+    if ( !evaluator ) {
+        evaluator = std::make_unique<ConstantEvaluator>(engine->getDataLayout(),
+                                                        engine->getTargetTriple(),
+                                                        options.fp_contract);
+    }
+    std::optional<double> value = evaluator->evaluate(
+        func, options.fold_budget, [this](llvm::StringRef name) { return fold_body(name); });
+    if ( value ) { func.eraseFromParent(); }
+    return value;
+}
+
+llvm::Expected<double>
+IRRenderer::evaluate(const std::string &name) {
+    double result = 0.0;
+    if (auto err = evaluate(name, [&result](double value) { result = value; })) {
+        return err;
+    }
+    return result;
+}
+
+llvm::Error
+IRRenderer::evaluate(llvm::ArrayRef<std::string> names,
+                     llvm::function_ref<void(double)> consume) {
+    llvm::orc::ThreadSafeModule tsm = take_module();
+
+    // The expression is called right away, so it is never added lazily. In
+    // lazy mode the transform layer optimizes it instead.
+    if ( !lazy_engine ) {
+        auto err = tsm.withModuleDo([this](Module &m) -> llvm::Error {
+            if (auto err = import_callees(m)) { return err; }
+            optimize_module(m);
+            return llvm::Error::success();
+        });
+        if ( err ) { return err; }
+    }
+
+    // Each batch of expressions gets a tracker of its own so its code, data
+    // and symbol table entries are freed as soon as it has run.
+    llvm::orc::ResourceTrackerSP tracker = anon_dylib->createResourceTracker();
+    if (auto err = engine->addIRModule(tracker, std::move(tsm))) {
+        llvm::consumeError(tracker->remove());
+        return err;
+    }
+
+    // Materialize the whole batch with one lookup, then run it in order
+    auto &es = engine->getExecutionSession();
+    llvm::orc::SymbolLookupSet lookup_set;
+    for ( auto &name : names ) {
+        lookup_set.add(engine->mangleAndIntern(name));
+    }
+
+    std::optional<PhaseTimer> timer(std::in_place, runtime->stats(), Phase::Materialize);
+    auto symbols = es.lookup(llvm::orc::makeJITDylibSearchOrder(anon_dylib),
+                             std::move(lookup_set));
+    timer.reset();
+    if ( !symbols ) {
+        llvm::consumeError(tracker->remove());
+        return symbols.takeError();
+    }
+
+    PhaseTimer execute_timer(runtime->stats(), Phase::Execute);
+    for ( auto &name : names ) {
+        auto &sym = (*symbols)[engine->mangleAndIntern(name)];
+        double (*func_pointer)() = sym.getAddress().toPtr<double(*)()>();
+        consume(func_pointer());
+    }
+
+    return tracker->remove();
+}
+
+llvm::Error
+IRRenderer::load(const std::string &path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if ( !buffer ) {
+        return llvm::createFileError(path, buffer.getError());
+    }
+
+    if ( llvm::identify_magic((*buffer)->getBuffer()) == llvm::file_magic::bitcode ) {
+        std::unique_ptr<Module> loaded;
+        {
+            auto lock = context.getLock();
+            auto parsed = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(),
+                                                 *context.getContext());
+            if ( !parsed ) { return parsed.takeError(); }
+            loaded = std::move(*parsed);
+        }
+
+        for ( auto &func : *loaded ) {
+            if ( !func.isDeclaration() ) {
+                signatures.define(func.getName(), func.arg_size(), func.doesNotAccessMemory());
+            }
+        }
+        return add_module(llvm::orc::ThreadSafeModule(std::move(loaded), context));
+    }
+
+    // Native objects carry their prototypes in a signature table
+    auto err = read_signatures((*buffer)->getMemBufferRef(),
+                               [this](llvm::StringRef name, unsigned arity, bool pure) {
+                                   signatures.define(name, arity, pure);
+                               });
+    if ( err ) { return err; }
+
+    return engine->addObjectFile(*session_dylib, std::move(*buffer));
+}
+
+llvm::Expected<ArrayMap>
+IRRenderer::array_map(const std::string &name) {
+    auto cached = array_maps.find(name);
+    if ( cached != array_maps.end() ) { return cached->second; }
+
+    std::optional<Signature> signature = this->signature(name);
+    if ( !signature || !signature->defined ) {
+        // Perhaps still in the current module
+        if (auto err = flush_definitions()) { return err; }
+        signature = this->signature(name);
+    }
+    if ( !signature || !signature->defined ) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "unknown function %s", name.c_str());
+    }
+
+    std::unique_ptr<Module> wrapper_module;
+    {
+        auto lock = context.getLock();
+        wrapper_module = std::make_unique<Module>(name + "_map", llvm_context());
+        wrapper_module->setDataLayout(engine->getDataLayout());
+        wrapper_module->setTargetTriple(engine->getTargetTriple().str());
+
+        Function *scalar = Function::Create(function_type(signature->arity),
+                                            Function::ExternalLinkage,
+                                            name, wrapper_module.get());
+        create_map_wrapper(*wrapper_module, scalar);
+
+        // Pull in the scalar body so it is inlined and the loop vectorized
+        if (auto err = import_definition(*wrapper_module, name)) {
+            return err;
+        }
+
+        std::lock_guard<std::mutex> optimizer_lock(optimizer_mutex);
+        llvm::ModulePassManager passes =
+            pass_builder->buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+        passes.run(*wrapper_module, *module_analyses);
+        clear_analyses();
+    }
+
+    llvm::orc::ThreadSafeModule tsm(std::move(wrapper_module), context);
+    if (auto err = engine->addIRModule(*session_dylib, std::move(tsm))) {
+        return err;
+    }
+
+    auto entry = lookup(name + "_map");
+    if ( !entry ) { return entry.takeError(); }
+
+    ArrayMap mapped(*entry, signature->arity, signature->pure);
+    array_maps[name] = mapped;
+    return mapped;
+}
+
+void
+IRRenderer::precompile(const std::vector<std::string> &names) {
+    auto &es = engine->getExecutionSession();
+
+    // In lazy mode the session dylib only holds stubs; the bodies live in
+    // the implementation dylib created by the CompileOnDemandLayer.
+    llvm::orc::JITDylib *jd = session_dylib;
+    if ( lazy_engine ) {
+        if ( auto *impl = es.getJITDylibByName(jd->getName() + ".impl") ) {
+            jd = impl;
+        }
+    }
+
+    llvm::orc::SymbolLookupSet symbols;
+    for ( auto &name : names ) {
+        symbols.add(engine->mangleAndIntern(name),
+                    llvm::orc::SymbolLookupFlags::WeaklyReferencedSymbol);
+    }
+
+    // Asynchronous lookup: materialization is dispatched to the compile
+    // threads and nobody waits for the result.
+    es.lookup(llvm::orc::LookupKind::Static,
+              llvm::orc::makeJITDylibSearchOrder(jd),
+              std::move(symbols),
+              llvm::orc::SymbolState::Ready,
+              [](llvm::Expected<llvm::orc::SymbolMap> result) {
+                  if ( !result ) {
+                      llvm::errs() << "Background compilation failed: "
+                                   << llvm::toString(result.takeError()) << "\n";
+                  }
+              },
+              llvm::orc::NoDependenciesToRegister);
+}
+
+JITMemoryUsage
+IRRenderer::jit_memory_usage() const {
+    return runtime->memory_usage();
+}
+
+llvm::Expected<llvm::orc::ExecutorAddr>
+IRRenderer::lookup(llvm::StringRef name) {
+    PhaseTimer timer(runtime->stats(), Phase::Lookup);
+    return engine->lookup(*session_dylib, name);
 }
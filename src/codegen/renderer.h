@@ -1,19 +1,41 @@
 #pragma once
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
 
-#include <map>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <vector>
+
+#include "array_map.h"
+#include "evaluator.h"
+#include "memory_plugin.h"
+#include "options.h"
+#include "profile.h"
+#include "runtime.h"
+#include "scope.h"
+#include "signatures.h"
+#include "tiering.h"
+#include "ast/identifier.h"
 
-using ::std::map;
 using ::std::string;
 using ::std::unique_ptr;
 
@@ -26,34 +48,111 @@ using ::llvm::orc::LLJIT;
 
 
 class IRRenderer {
-    map<string, AllocaInst*> named_values;
-    map<string, int> function_arg_counts;  // Store function name -> argument count
+    ScopeTable named_values;
+    SignatureTable signatures;
+    llvm::SmallVector<llvm::FunctionType*, 8> function_types;  // By arity, current context
+
+    RendererOptions options;
+    std::shared_ptr<JITRuntime> runtime;
+    unique_ptr<llvm::TargetMachine> target_machine;
+    llvm::orc::LLLazyJIT *lazy_engine = nullptr;
+    llvm::orc::JITDylib *session_dylib = nullptr;  // Definitions of this session
+    llvm::orc::JITDylib *anon_dylib = nullptr;  // Short lived expression modules
+    unsigned context_modules = 0;
+
+    // Bitcode of the modules handed to the JIT, by defined function, so
+    // bodies can still be imported for inlining
+    struct RetainedDefinition {
+        std::shared_ptr<const llvm::SmallVector<char, 0> > bitcode;
+        unsigned instructions = 0;  // Decides imports without parsing it
+    };
+    llvm::StringMap<RetainedDefinition> library;
+    std::mutex library_mutex;  // Also read by the tiering thread
+    llvm::StringMap<ArrayMap> array_maps;
+    unique_ptr<Profile> profile_data;  // Only with options.profile
+    unique_ptr<TierManager> tiers;  // Only with options.tiered
+
+    // Retained definitions parsed for the constant evaluator, by name
+    unique_ptr<ConstantEvaluator> evaluator;
+    unique_ptr<LLVMContext> fold_context;
+    std::vector<unique_ptr<Module> > fold_modules;
+    llvm::StringMap<Function*> fold_bodies;
+
+    unique_ptr<llvm::LoopAnalysisManager> loop_analyses;
+    unique_ptr<llvm::FunctionAnalysisManager> function_analyses;
+    unique_ptr<llvm::CGSCCAnalysisManager> cgscc_analyses;
+    unique_ptr<llvm::ModuleAnalysisManager> module_analyses;
+    unique_ptr<llvm::PassInstrumentationCallbacks> pass_callbacks;
+    unique_ptr<llvm::TimePassesHandler> pass_timers;  // Only with time_passes
+    unique_ptr<llvm::PassBuilder> pass_builder;
+    unique_ptr<llvm::FunctionPassManager> function_passes;
+    unique_ptr<llvm::ModulePassManager> module_passes;
+    std::mutex optimizer_mutex;  // Pipelines also run on compile threads
 
     IRRenderer(const IRRenderer &other);
-    IRRenderer(Module *module);
+    IRRenderer(std::shared_ptr<JITRuntime> runtime, Module *module);
     IRRenderer(IRRenderer &&other);
 
     IRRenderer &operator =(IRRenderer other);
 
+    void create_session();
+    void create_pass_pipelines();
+    void clear_analyses();
+    bool has_definitions();
+    llvm::StringMap<RetainedDefinition> retain_definitions(Module &source);
+    void keep_definitions(llvm::StringMap<RetainedDefinition> retained);
+    llvm::Error import_definition(Module &dest, llvm::StringRef name,
+                                  unsigned max_instructions = std::numeric_limits<unsigned>::max());
+    llvm::Error import_callees(Module &target);
+    Function *fold_body(llvm::StringRef name);
+    llvm::orc::ThreadSafeModule take_module();
+
 public:
     IRRenderer();
+    explicit IRRenderer(const RendererOptions &options);
+    explicit IRRenderer(std::shared_ptr<JITRuntime> runtime);
     ~IRRenderer();
 
-    unique_ptr<LLVMContext> context;
+    llvm::orc::ThreadSafeContext context;
     unique_ptr<Module> module;
-    unique_ptr<LLJIT> engine;
+    LLJIT *engine = nullptr;  // Owned by the runtime
     unique_ptr<IRBuilder<> > builder;
 
     LLVMContext &llvm_context();
+    void reset_module();
+    unique_ptr<Module> detach_module();
 
-    AllocaInst *get_named_value(const std::string &name);
-    void set_named_value(const std::string &name, AllocaInst* value);
-    void clear_named_value(const std::string &name);
+    AllocaInst *get_named_value(Identifier name);
+    void set_named_value(Identifier name, AllocaInst* value);
+    void push_scope();
+    void pop_scope();
     void clear_all_named_values();
 
-    AllocaInst *create_entry_block_alloca(Function *func, const std::string &name);
+    AllocaInst *create_entry_block_alloca(Function *func, llvm::StringRef name);
     void declare_external_function(const std::string &name);
-    Function *get_function(const std::string &name);
-    void add_function_type(const std::string &name, llvm::FunctionType *type);
+    llvm::FunctionType *function_type(unsigned arity);
+    Function *get_function(llvm::StringRef name);
+    void add_function_type(llvm::StringRef name, llvm::FunctionType *type);
+    std::optional<Signature> signature(llvm::StringRef name) const;
+    SignatureTable signature_snapshot() const { return signatures; }
+    void restore_signatures(SignatureTable saved) { signatures = std::move(saved); }
     void reset_function_types();
+    void infer_purity(Function *func);
+
+    void optimize_function(Function *func);
+    void optimize_module(Module &target);
+    llvm::Error add_module(llvm::orc::ThreadSafeModule tsm);
+    llvm::Error flush_definitions();
+    llvm::Error promote(FunctionTier &tier);
+    std::optional<double> fold_expression(Function &func);
+    llvm::Error load(const std::string &path);
+    llvm::Expected<ArrayMap> array_map(const std::string &name);
+    llvm::Expected<double> evaluate(const std::string &name);
+    llvm::Error evaluate(llvm::ArrayRef<std::string> names,
+                         llvm::function_ref<void(double)> consume);
+    llvm::Expected<llvm::orc::ExecutorAddr> lookup(llvm::StringRef name);
+    void precompile(const std::vector<std::string> &names);
+    JITMemoryUsage jit_memory_usage() const;
+    CompileStats *stats() const { return runtime->stats(); }
+    Profile *profile() const { return profile_data.get(); }
 };
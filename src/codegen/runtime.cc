@@ -0,0 +1,405 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/Debugging/DebuggerSupport.h"
+#include "llvm/ExecutionEngine/Orc/Debugging/PerfSupportPlugin.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRPartitionLayer.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/JITLoaderGDB.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/JITLoaderPerf.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+#include <cstdlib>
+#include <string>
+
+#include "emitter.h"
+#include "perf_map.h"
+#include "renderer.h"
+#include "runtime.h"
+
+
+std::shared_ptr<JITRuntime>
+JITRuntime::create(const RendererOptions &options) {
+    return std::shared_ptr<JITRuntime>(new JITRuntime(options));
+}
+
+JITRuntime::JITRuntime(const RendererOptions &options) : settings(options) {
+    if ( settings.stats ) {
+        compile_stats = std::make_unique<CompileStats>();
+    }
+    create_engine();
+}
+
+JITRuntime::~JITRuntime() {
+    jit.reset();
+    object_cache.reset();
+}
+
+static llvm::CodeGenOptLevel
+codegen_opt_level(int level) {
+    switch (level) {
+    case 0: return llvm::CodeGenOptLevel::None;
+    case 1: return llvm::CodeGenOptLevel::Less;
+    case 2: return llvm::CodeGenOptLevel::Default;
+    default: return llvm::CodeGenOptLevel::Aggressive;
+    }
+}
+
+int
+JITRuntime::codegen_level() const {
+    return settings.codegen_opt_level >= 0
+        ? settings.codegen_opt_level
+        : static_cast<int>(settings.opt_level);
+}
+
+llvm::orc::JITTargetMachineBuilder
+JITRuntime::target_machine_builder() const {
+    auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (auto err = jtmb.takeError()) {
+        llvm::errs() << "Could not detect host target: " << err << "\n";
+        exit(1);
+    }
+
+    if ( !settings.cpu.empty() ) {
+        jtmb->setCPU(settings.cpu);
+    }
+
+    if ( !settings.features.empty() ) {
+        llvm::SmallVector<llvm::StringRef, 8> features;
+        llvm::StringRef(settings.features).split(features, ',', -1, false);
+        for ( auto &feature : features ) {
+            jtmb->getFeatures().AddFeature(feature.trim());
+        }
+    }
+
+    jtmb->setCodeGenOptLevel(codegen_opt_level(codegen_level()));
+
+    if ( settings.fp_contract ) {
+        jtmb->getOptions().AllowFPOpFusion = llvm::FPOpFusion::Fast;
+    }
+    return std::move(*jtmb);
+}
+
+/// TimedCompiler - charges object code generation to the compile phase.
+class TimedCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> compiler;
+    CompileStats *stats;
+
+public:
+    TimedCompiler(std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> compiler,
+                  CompileStats *stats)
+        : IRCompiler(compiler->getManglingOptions()),
+          compiler(std::move(compiler)),
+          stats(stats) {}
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+    operator()(llvm::Module &module) override {
+        PhaseTimer timer(stats, Phase::Compile);
+        return (*compiler)(module);
+    }
+};
+
+void
+JITRuntime::create_engine() {
+    auto jtmb = target_machine_builder();
+
+    if ( !settings.object_cache_dir.empty() ) {
+        auto tm = jtmb.createTargetMachine();
+        if (auto err = tm.takeError()) {
+            llvm::errs() << "Could not create target machine: " << err << "\n";
+            exit(1);
+        }
+
+        std::string salt;
+        llvm::raw_string_ostream salt_stream(salt);
+        salt_stream << (*tm)->getTargetTriple().str() << ';'
+                    << (*tm)->getTargetCPU() << ';'
+                    << (*tm)->getTargetFeatureString() << ';'
+                    << "O" << settings.opt_level << ';'
+                    << "codegen" << codegen_level() << ';'
+                    << "fp-contract" << settings.fp_contract;
+        salt_stream.flush();
+
+        object_cache = std::make_unique<DiskObjectCache>(settings.object_cache_dir, salt);
+    }
+
+    auto configure = [&](auto &jit_builder) {
+        jit_builder.setJITTargetMachineBuilder(std::move(jtmb));
+        jit_builder.setNumCompileThreads(settings.compile_threads);
+
+        if ( !object_cache && !compile_stats ) { return; }
+
+        unsigned threads = settings.compile_threads;
+        jit_builder.setCompileFunctionCreator(
+            [this, threads](llvm::orc::JITTargetMachineBuilder tmb)
+                -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+                std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> compiler;
+                if ( threads > 0 ) {
+                    compiler = std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+                        std::move(tmb), object_cache.get());
+                } else {
+                    auto tm = tmb.createTargetMachine();
+                    if ( !tm ) { return tm.takeError(); }
+                    compiler = std::make_unique<llvm::orc::TMOwningSimpleCompiler>(
+                        std::move(*tm), object_cache.get());
+                }
+
+                if ( compile_stats ) {
+                    return std::make_unique<TimedCompiler>(std::move(compiler),
+                                                           compile_stats.get());
+                }
+                return std::move(compiler);
+            });
+    };
+
+    if ( settings.lazy ) {
+        auto jit_builder = llvm::orc::LLLazyJITBuilder();
+        configure(jit_builder);
+        auto initResult = jit_builder.create();
+        if (auto err = initResult.takeError()) {
+            llvm::errs() << "Could not create LLLazyJIT: " << err << "\n";
+            exit(1);
+        }
+
+        lazy_jit = initResult->get();
+        lazy_jit->setPartitionFunction(
+            llvm::orc::IRPartitionLayer::compileRequested);
+        jit = std::move(initResult.get());
+
+        // Partitions extracted for the CompileOnDemandLayer pass through the
+        // transform layer, so module optimization is deferred along with
+        // compilation.
+        jit->getIRTransformLayer().setTransform(
+            [this](llvm::orc::ThreadSafeModule tsm,
+                   llvm::orc::MaterializationResponsibility &R)
+                -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+                std::shared_lock<std::shared_mutex> guard(sessions_mutex);
+                if ( IRRenderer *session = session_for(R.getTargetJITDylib()) ) {
+                    tsm.withModuleDo([session](llvm::Module &m) { session->optimize_module(m); });
+                }
+                return std::move(tsm);
+            });
+    } else {
+        auto jit_builder = llvm::orc::LLJITBuilder();
+        configure(jit_builder);
+        auto initResult = jit_builder.create();
+        if (auto err = initResult.takeError()) {
+            llvm::errs() << "Could not create LLJIT: " << err << "\n";
+            exit(1);
+        }
+
+        jit = std::move(initResult.get());
+    }
+
+    prelude_dylib = &jit->getMainJITDylib();
+
+    // Only JITLink exposes the link graph needed to account for memory.
+    if ( auto *linking_layer = llvm::dyn_cast<llvm::orc::ObjectLinkingLayer>(
+             &jit->getObjLinkingLayer()) ) {
+        auto plugin = std::make_unique<MemoryUsagePlugin>();
+        memory_plugin = plugin.get();
+        linking_layer->addPlugin(std::move(plugin));
+    }
+
+    enable_tool_support();
+}
+
+// Looked up by name in this process by the jitdump and debugger plugins;
+// referenced here so the linker keeps them. The executable must export its
+// symbols (-rdynamic) for the lookup to find them.
+LLVM_ATTRIBUTE_USED static void *const tool_entry_points[] = {
+    (void*)&llvm_orc_registerJITLoaderGDBWrapper,
+    (void*)&llvm_orc_registerJITLoaderGDBAllocAction,
+    (void*)&llvm_orc_registerJITLoaderPerfStart,
+    (void*)&llvm_orc_registerJITLoaderPerfEnd,
+    (void*)&llvm_orc_registerJITLoaderPerfImpl,
+};
+
+/// enable_tool_support - make JIT code visible to perf and debuggers. These
+/// are diagnostics, so a host that cannot support one only gets a warning.
+void
+JITRuntime::enable_tool_support() {
+    auto *linking_layer = llvm::dyn_cast<llvm::orc::ObjectLinkingLayer>(&jit->getObjLinkingLayer());
+    auto *rtdyld_layer = llvm::dyn_cast<llvm::orc::RTDyldObjectLinkingLayer>(&jit->getObjLinkingLayer());
+
+    if ( settings.perf && linking_layer ) {
+        auto perf_map = PerfMapPlugin::create();
+        if ( perf_map ) {
+            linking_layer->addPlugin(std::move(*perf_map));
+        } else {
+            llvm::errs() << "Warning: no perf map: " << llvm::toString(perf_map.takeError()) << "\n";
+        }
+
+        auto process = jit->getProcessSymbolsJITDylib();
+        if ( process && jit->getTargetTriple().isOSBinFormatELF() ) {
+            auto jitdump = llvm::orc::PerfSupportPlugin::Create(
+                jit->getExecutionSession().getExecutorProcessControl(), *process,
+                /*EmitDebugInfo=*/true, /*EmitUnwindInfo=*/true);
+            if ( jitdump ) {
+                linking_layer->addPlugin(std::move(*jitdump));
+            } else {
+                llvm::errs() << "Warning: no jitdump records: " << llvm::toString(jitdump.takeError()) << "\n";
+            }
+        }
+    } else if ( settings.perf && rtdyld_layer ) {
+        if ( auto *listener = llvm::JITEventListener::createPerfJITEventListener() ) {
+            rtdyld_layer->registerJITEventListener(*listener);
+        } else {
+            llvm::errs() << "Warning: this LLVM was built without perf support\n";
+        }
+    }
+
+    if ( settings.debugger && rtdyld_layer ) {
+        rtdyld_layer->registerJITEventListener(
+            *llvm::JITEventListener::createGDBRegistrationListener());
+    } else if ( settings.debugger ) {
+        if (auto err = llvm::orc::enableDebuggerSupport(*jit)) {
+            llvm::errs() << "Warning: no debugger support: " << llvm::toString(std::move(err)) << "\n";
+        }
+    }
+}
+
+IRRenderer *
+JITRuntime::session_for(llvm::orc::JITDylib &dylib) {
+    // Bodies of lazy sessions are compiled in "<session>.impl", their
+    // expressions in "<session>.anon"
+    llvm::StringRef name = dylib.getName();
+    if ( !name.consume_back(".impl") ) {
+        name.consume_back(".anon");
+    }
+
+    auto found = sessions.find(name);
+    return found == sessions.end() ? nullptr : found->second;
+}
+
+llvm::Expected<llvm::orc::JITDylib&>
+JITRuntime::open_session(IRRenderer *renderer) {
+    std::unique_lock<std::shared_mutex> guard(sessions_mutex);
+
+    std::string name = "session." + std::to_string(next_session++);
+    auto dylib = jit->createJITDylib(name);
+    if ( !dylib ) { return dylib.takeError(); }
+
+    dylib->addToLinkOrder(*prelude_dylib);
+    sessions[name] = renderer;
+    return *dylib;
+}
+
+void
+JITRuntime::close_session(llvm::orc::JITDylib &dylib) {
+    std::string name = dylib.getName();
+    {
+        // Waits for partitions of the session still being optimized
+        std::unique_lock<std::shared_mutex> guard(sessions_mutex);
+        sessions.erase(name);
+    }
+
+    auto &es = jit->getExecutionSession();
+    if ( auto *anon = es.getJITDylibByName(name + ".anon") ) {
+        if (auto err = es.removeJITDylib(*anon)) {
+            llvm::errs() << "Could not remove " << name << ".anon: "
+                         << llvm::toString(std::move(err)) << "\n";
+        }
+    }
+
+    // The CompileOnDemandLayer keeps the ".impl" dylib and stubs of every
+    // lazy session, by the session dylib's address, and has no way to
+    // forget them. Removing either would let a later session reuse a
+    // dangling record, so lazy sessions stay until the runtime goes.
+    if ( lazy_jit ) { return; }
+
+    if (auto err = es.removeJITDylib(dylib)) {
+        llvm::errs() << "Could not remove " << name << ": "
+                     << llvm::toString(std::move(err)) << "\n";
+    }
+}
+
+void
+JITRuntime::move_session(llvm::orc::JITDylib &dylib, IRRenderer *renderer) {
+    std::unique_lock<std::shared_mutex> guard(sessions_mutex);
+    sessions[dylib.getName()] = renderer;
+}
+
+llvm::Error
+JITRuntime::define_builtin(llvm::StringRef name, void *address, unsigned arity) {
+    llvm::orc::SymbolMap symbols;
+    symbols[jit->mangleAndIntern(name)] = llvm::orc::ExecutorSymbolDef(
+        llvm::orc::ExecutorAddr::fromPtr(address), llvm::JITSymbolFlags::Callable);
+    if (auto err = prelude_dylib->define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+        return err;
+    }
+
+    std::lock_guard<std::mutex> guard(prelude_mutex);
+    prelude_signatures.declare(name, arity);
+    return llvm::Error::success();
+}
+
+llvm::Error
+JITRuntime::load_prelude(const std::string &path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if ( !buffer ) {
+        return llvm::createFileError(path, buffer.getError());
+    }
+
+    // Bitcode written by -emit=bc is already optimized and goes in as is
+    if ( llvm::identify_magic((*buffer)->getBuffer()) == llvm::file_magic::bitcode ) {
+        llvm::orc::ThreadSafeContext context(std::make_unique<llvm::LLVMContext>());
+        auto parsed = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(),
+                                             *context.getContext());
+        if ( !parsed ) { return parsed.takeError(); }
+
+        {
+            std::lock_guard<std::mutex> guard(prelude_mutex);
+            for ( auto &func : **parsed ) {
+                if ( !func.isDeclaration() ) {
+                    prelude_signatures.define(func.getName(), func.arg_size(),
+                                              func.doesNotAccessMemory());
+                }
+            }
+        }
+        return jit->addIRModule(*prelude_dylib,
+                                llvm::orc::ThreadSafeModule(std::move(*parsed), context));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(prelude_mutex);
+        auto err = read_signatures((*buffer)->getMemBufferRef(),
+                                   [this](llvm::StringRef name, unsigned arity, bool pure) {
+                                       prelude_signatures.define(name, arity, pure);
+                                   });
+        if ( err ) { return err; }
+    }
+    return jit->addObjectFile(*prelude_dylib, std::move(*buffer));
+}
+
+std::optional<Signature>
+JITRuntime::prelude_signature(llvm::StringRef name) const {
+    std::lock_guard<std::mutex> guard(prelude_mutex);
+    const Signature *signature = prelude_signatures.find(name);
+    if ( signature == nullptr ) { return std::nullopt; }
+
+    return *signature;
+}
+
+JITMemoryUsage
+JITRuntime::memory_usage() const {
+    if ( !memory_plugin ) { return JITMemoryUsage(); }
+
+    return memory_plugin->usage();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+
+#include "memory_plugin.h"
+#include "object_cache.h"
+#include "options.h"
+#include "signatures.h"
+#include "stats.h"
+
+class IRRenderer;
+
+
+/// JITRuntime - the part of the JIT shared by every session of a process:
+/// one ExecutionSession with its compile threads, linking layer and object
+/// cache, plus a prelude dylib with the builtins and preloaded libraries.
+///
+/// Each IRRenderer opens a session of its own: a JITDylib that links
+/// against the prelude, so sessions cannot see each other's definitions and
+/// are cheap to create and drop.
+class JITRuntime {
+    RendererOptions settings;
+    std::unique_ptr<DiskObjectCache> object_cache;  // Used by the compilers
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    llvm::orc::LLLazyJIT *lazy_jit = nullptr;
+    llvm::orc::JITDylib *prelude_dylib = nullptr;
+    MemoryUsagePlugin *memory_plugin = nullptr;  // Owned by the linking layer
+    std::unique_ptr<CompileStats> compile_stats;  // Only with stats enabled
+
+    mutable std::mutex prelude_mutex;
+    SignatureTable prelude_signatures;
+
+    // Sessions by dylib name, so lazily extracted partitions are optimized
+    // by the renderer they belong to
+    std::shared_mutex sessions_mutex;
+    llvm::StringMap<IRRenderer*> sessions;
+    unsigned next_session = 0;
+
+    explicit JITRuntime(const RendererOptions &options);
+    void create_engine();
+    void enable_tool_support();
+    IRRenderer *session_for(llvm::orc::JITDylib &dylib);
+
+public:
+    static std::shared_ptr<JITRuntime> create(const RendererOptions &options);
+    ~JITRuntime();
+
+    JITRuntime(const JITRuntime &) = delete;
+    JITRuntime &operator =(const JITRuntime &) = delete;
+
+    const RendererOptions &options() const { return settings; }
+    llvm::orc::LLJIT &engine() { return *jit; }
+    llvm::orc::LLLazyJIT *lazy_engine() { return lazy_jit; }
+    llvm::orc::JITDylib &prelude() { return *prelude_dylib; }
+
+    int codegen_level() const;
+    llvm::orc::JITTargetMachineBuilder target_machine_builder() const;
+
+    // A new session dylib linked against the prelude, and its removal.
+    // Lazy sessions only drop their expressions; their code stays.
+    llvm::Expected<llvm::orc::JITDylib&> open_session(IRRenderer *renderer);
+    void close_session(llvm::orc::JITDylib &dylib);
+    void move_session(llvm::orc::JITDylib &dylib, IRRenderer *renderer);
+
+    llvm::Error define_builtin(llvm::StringRef name, void *address, unsigned arity);
+    llvm::Error load_prelude(const std::string &path);
+    std::optional<Signature> prelude_signature(llvm::StringRef name) const;
+
+    // Across all sessions
+    JITMemoryUsage memory_usage() const;
+    CompileStats *stats() const { return compile_stats.get(); }
+};
@@ -0,0 +1,49 @@
+#include "llvm/IR/Instructions.h"
+
+#include "scope.h"
+
+
+llvm::AllocaInst *
+ScopeTable::lookup(Identifier name) const {
+    auto it = bindings.find(name.key());
+    if ( it == bindings.end() ) { return nullptr; }
+
+    return it->second;
+}
+
+void
+ScopeTable::bind(Identifier name, llvm::AllocaInst *value) {
+    llvm::AllocaInst *&slot = bindings[name.key()];
+    if ( !scopes.empty() ) {
+        shadowed.push_back(Shadowed{name.key(), slot});
+    }
+    slot = value;
+}
+
+void
+ScopeTable::push_scope() {
+    scopes.push_back(shadowed.size());
+}
+
+void
+ScopeTable::pop_scope() {
+    size_t mark = scopes.back();
+    scopes.pop_back();
+
+    while ( shadowed.size() > mark ) {
+        Shadowed &entry = shadowed.back();
+        if ( entry.previous ) {
+            bindings[entry.key] = entry.previous;
+        } else {
+            bindings.erase(entry.key);
+        }
+        shadowed.pop_back();
+    }
+}
+
+void
+ScopeTable::clear() {
+    bindings.clear();
+    shadowed.clear();
+    scopes.clear();
+}
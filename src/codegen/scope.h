@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+
+#include "ast/identifier.h"
+
+
+/// ScopeTable - lexical bindings of variable names to their allocas.
+///
+/// The visible binding of every name lives in one flat hash table keyed by
+/// the interned identifier. Binding a name inside a scope records what it
+/// shadowed, and popping the scope restores those entries, so lookups never
+/// walk a chain of scopes.
+class ScopeTable {
+    struct Shadowed {
+        const void *key;
+        llvm::AllocaInst *previous;
+    };
+
+    llvm::DenseMap<const void*, llvm::AllocaInst*> bindings;
+    std::vector<Shadowed> shadowed;
+    std::vector<size_t> scopes;
+
+public:
+    llvm::AllocaInst *lookup(Identifier name) const;
+    void bind(Identifier name, llvm::AllocaInst *value);
+
+    void push_scope();
+    void pop_scope();
+    void clear();
+};
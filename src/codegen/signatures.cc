@@ -0,0 +1,25 @@
+#include "llvm/ADT/StringRef.h"
+
+#include "signatures.h"
+
+
+void
+SignatureTable::declare(llvm::StringRef name, unsigned arity) {
+    auto result = entries.try_emplace(name, Signature{arity, false, false});
+    if ( !result.second ) {
+        result.first->second.arity = arity;
+    }
+}
+
+void
+SignatureTable::define(llvm::StringRef name, unsigned arity, bool pure) {
+    entries[name] = Signature{arity, true, pure};
+}
+
+const Signature *
+SignatureTable::find(llvm::StringRef name) const {
+    auto it = entries.find(name);
+    if ( it == entries.end() ) { return nullptr; }
+
+    return &it->second;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+
+struct Signature {
+    unsigned arity;  // Every parameter and the result are doubles
+    bool defined;    // A body was compiled, not just an extern prototype
+    bool pure;       // Calls nothing with side effects (putchard, printd, ...)
+};
+
+/// SignatureTable - prototypes of every function seen so far, so calls
+/// across modules can be declared without asking the JIT.
+class SignatureTable {
+    llvm::StringMap<Signature> entries;
+
+public:
+    void declare(llvm::StringRef name, unsigned arity);
+    void define(llvm::StringRef name, unsigned arity, bool pure);
+    const Signature *find(llvm::StringRef name) const;
+};
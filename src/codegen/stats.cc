@@ -0,0 +1,163 @@
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+
+
+static const char *phase_names[] = {
+    "parse", "codegen", "verify", "optimize", "add-module", "compile", "materialize", "lookup",
+    "execute",
+};
+
+CompileStats::CompileStats() {
+    // Counters of LLVM's own passes, when it was built with them
+    llvm::EnableStatistics(false);
+}
+
+void
+CompileStats::add(Phase phase, const llvm::TimeRecord &time) {
+    std::lock_guard<std::mutex> guard(lock);
+    phases[static_cast<unsigned>(phase)] += time;
+}
+
+void
+CompileStats::record_module(const llvm::Module &module) {
+    std::lock_guard<std::mutex> guard(lock);
+    modules++;
+    for ( auto &func : module ) {
+        if ( func.isDeclaration() ) { continue; }
+
+        // Each top level expression is its own __anon_expr function; sum
+        // them under one entry, as the profile does
+        if ( func.getName().starts_with("__anon_expr") ) {
+            FunctionCounts &counts = functions["(top level)"];
+            counts.instructions += func.getInstructionCount();
+            counts.blocks += func.size();
+            continue;
+        }
+        FunctionCounts &counts = functions[func.getName()];
+        counts.instructions = func.getInstructionCount();
+        counts.blocks = func.size();
+    }
+}
+
+static std::vector<std::pair<llvm::StringRef, size_t> >
+by_size(const llvm::StringMap<size_t> &sizes) {
+    std::vector<std::pair<llvm::StringRef, size_t> > sorted;
+    for ( auto &entry : sizes ) {
+        sorted.emplace_back(entry.getKey(), entry.getValue());
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    return sorted;
+}
+
+void
+CompileStats::print(llvm::raw_ostream &out, const JITMemoryUsage &memory) const {
+    std::lock_guard<std::mutex> guard(lock);
+
+    llvm::StringMap<llvm::TimeRecord> records;
+    for ( unsigned i = 0; i < std::size(phase_names); i++ ) {
+        records[phase_names[i]] = phases[i];
+    }
+    llvm::TimerGroup("kscope", "Compilation phases", records).print(out);
+
+    llvm::StringMap<size_t> instructions;
+    for ( auto &entry : functions ) {
+        instructions[entry.getKey()] = entry.getValue().instructions;
+    }
+    out << "Functions after optimization (" << modules << " modules):\n";
+    out << "     insts   blocks  name\n";
+    for ( auto &entry : by_size(instructions) ) {
+        out << llvm::format("%10zu %8zu  ", entry.second,
+                            functions.lookup(entry.first).blocks)
+            << entry.first << "\n";
+    }
+    out << "JIT code: " << memory.code_bytes << " bytes, data: "
+        << memory.data_bytes << " bytes\n";
+
+    auto statistics = llvm::GetStatistics();
+    if ( !statistics.empty() ) {
+        out << "LLVM statistics:\n";
+        for ( auto &entry : statistics ) {
+            out << llvm::format("%10u  ", entry.second) << entry.first << "\n";
+        }
+    }
+}
+
+void
+CompileStats::print_json(llvm::raw_ostream &out, const JITMemoryUsage &memory) const {
+    std::lock_guard<std::mutex> guard(lock);
+
+    llvm::json::OStream json(out, 2);
+    json.object([&] {
+        json.attributeObject("phases", [&] {
+            for ( unsigned i = 0; i < std::size(phase_names); i++ ) {
+                json.attributeObject(phase_names[i], [&] {
+                    json.attribute("wall", phases[i].getWallTime());
+                    json.attribute("user", phases[i].getUserTime());
+                    json.attribute("system", phases[i].getSystemTime());
+                });
+            }
+        });
+        json.attribute("modules", static_cast<int64_t>(modules));
+        json.attributeObject("functions", [&] {
+            for ( auto &entry : functions ) {
+                json.attributeObject(entry.getKey(), [&] {
+                    json.attribute("instructions", static_cast<int64_t>(entry.getValue().instructions));
+                    json.attribute("blocks", static_cast<int64_t>(entry.getValue().blocks));
+                });
+            }
+        });
+        json.attributeObject("jit", [&] {
+            json.attribute("code_bytes", static_cast<int64_t>(memory.code_bytes));
+            json.attribute("data_bytes", static_cast<int64_t>(memory.data_bytes));
+        });
+        json.attributeObject("statistics", [&] {
+            for ( auto &entry : llvm::GetStatistics() ) {
+                json.attribute(entry.first, static_cast<int64_t>(entry.second));
+            }
+        });
+    });
+    out << "\n";
+}
+
+// The innermost running timer of each thread
+static thread_local PhaseTimer *running = nullptr;
+
+PhaseTimer::PhaseTimer(CompileStats *stats, Phase phase) : stats(stats), phase(phase) {
+    if ( stats == nullptr ) { return; }
+
+    enclosing = running;
+    if ( enclosing ) { enclosing->pause(); }
+    running = this;
+    resume();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if ( stats == nullptr ) { return; }
+
+    pause();
+    stats->add(phase, elapsed);
+    running = enclosing;
+    if ( enclosing ) { enclosing->resume(); }
+}
+
+void
+PhaseTimer::pause() {
+    elapsed += llvm::TimeRecord::getCurrentTime(false);
+}
+
+void
+PhaseTimer::resume() {
+    elapsed -= llvm::TimeRecord::getCurrentTime(true);
+}
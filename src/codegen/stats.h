@@ -0,0 +1,67 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstddef>
+#include <mutex>
+
+#include "memory_plugin.h"
+
+
+enum class Phase {
+    Parse,        // Lexing and parsing, interleaved by bison
+    Codegen,      // AST to IR
+    Verify,       // verifyFunction
+    Optimize,     // Function and module pass pipelines
+    AddModule,    // Handing modules to the JIT
+    Compile,      // IR to object code, on whichever thread compiles
+    Materialize,  // Linking top level expressions, waiting on compile threads
+    Lookup,       // Resolving function addresses, including what they pull in
+    Execute,      // Running top level expressions
+};
+
+/// CompileStats - wall and CPU time per compilation phase, summed over all
+/// threads, and the size of every function after optimization.
+class CompileStats {
+    struct FunctionCounts {
+        size_t instructions = 0;
+        size_t blocks = 0;
+    };
+
+    mutable std::mutex lock;
+    llvm::TimeRecord phases[static_cast<unsigned>(Phase::Execute) + 1];
+    llvm::StringMap<FunctionCounts> functions;
+    size_t modules = 0;
+
+public:
+    CompileStats();
+
+    void add(Phase phase, const llvm::TimeRecord &time);
+    void record_module(const llvm::Module &module);
+
+    void print(llvm::raw_ostream &out, const JITMemoryUsage &memory) const;
+    void print_json(llvm::raw_ostream &out, const JITMemoryUsage &memory) const;
+};
+
+/// PhaseTimer - charges the time until it goes out of scope to a phase.
+/// Timers nested on one thread pause the enclosing one, so every moment is
+/// charged to exactly one phase. Does nothing without stats.
+class PhaseTimer {
+    CompileStats *stats;
+    Phase phase;
+    PhaseTimer *enclosing = nullptr;
+    llvm::TimeRecord elapsed;
+
+    void pause();
+    void resume();
+
+public:
+    PhaseTimer(CompileStats *stats, Phase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator =(const PhaseTimer &) = delete;
+};
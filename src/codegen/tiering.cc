@@ -0,0 +1,204 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/ModRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "profile.h"
+#include "renderer.h"
+#include "tiering.h"
+
+using ::llvm::BasicBlock;
+using ::llvm::BranchInst;
+using ::llvm::Function;
+
+
+TierManager::TierManager(IRRenderer *renderer, llvm::orc::LLJIT &jit, unsigned threshold)
+    : renderer(renderer),
+      jit(jit),
+      threshold(std::max(threshold, 1u)) {
+    auto builder = llvm::orc::createLocalIndirectStubsManagerBuilder(jit.getTargetTriple());
+    if ( !builder ) {
+        llvm::errs() << "No indirect stubs for " << jit.getTargetTriple().str() << "\n";
+        exit(1);
+    }
+    stubs = builder();
+
+    worker = std::thread([this] { promote_queued(); });
+}
+
+TierManager::~TierManager() {
+    stop();
+}
+
+void
+TierManager::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        queue.clear();
+    }
+    wake.notify_all();
+    if ( worker.joinable() ) { worker.join(); }
+}
+
+/// request_promotion - called by tier 0 code the moment its call count
+/// reaches the threshold, on whatever thread is running it.
+void
+TierManager::request_promotion(FunctionTier *tier) {
+    if ( tier->promoted.exchange(true) ) { return; }
+
+    TierManager *manager = tier->manager;
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        if ( manager->stopping ) { return; }
+        manager->queue.push_back(tier);
+    }
+    manager->wake.notify_one();
+}
+
+void
+TierManager::promote_queued() {
+    std::unique_lock<std::mutex> guard(lock);
+    while ( true ) {
+        wake.wait(guard, [this] { return stopping || !queue.empty(); });
+        if ( stopping ) { return; }
+
+        FunctionTier *tier = queue.front();
+        queue.pop_front();
+        guard.unlock();
+
+        if (auto err = renderer->promote(*tier)) {
+            llvm::errs() << "Could not optimize " << tier->name << ": "
+                         << llvm::toString(std::move(err)) << "\n";
+        }
+        guard.lock();
+    }
+}
+
+std::vector<std::string>
+TierManager::instrument(llvm::Module &module) {
+    llvm::LLVMContext &context = module.getContext();
+    llvm::Type *pointer_type = llvm::PointerType::getUnqual(context);
+    llvm::FunctionType *request_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(context), {pointer_type}, false);
+
+    std::vector<Function*> definitions;
+    for ( auto &func : module ) {
+        if ( !func.isDeclaration() ) { definitions.push_back(&func); }
+    }
+
+    std::vector<std::string> names;
+    for ( Function *func : definitions ) {
+        std::string name = func->getName().str();
+
+        auto tier = std::make_unique<FunctionTier>();
+        tier->manager = this;
+        tier->name = name;
+        tier->arity = func->arg_size();
+
+        llvm::SmallVector<BranchInst*, 8> branches;
+        for ( auto &block : *func ) {
+            auto *branch = llvm::dyn_cast<BranchInst>(block.getTerminator());
+            if ( branch && branch->isConditional() ) { branches.push_back(branch); }
+        }
+        tier->branches = std::make_unique<BranchCounters[]>(branches.size());
+        tier->branch_count = branches.size();
+
+        llvm::IRBuilder<> builder(context);
+        for ( unsigned i = 0; i < branches.size(); i++ ) {
+            builder.SetInsertPoint(branches[i]);
+            Profile::increment(builder, &tier->branches[i].executed, builder.getInt64(1));
+            Profile::increment(builder, &tier->branches[i].taken,
+                               builder.CreateZExt(branches[i]->getCondition(), builder.getInt64Ty()));
+        }
+
+        // After the allocas, so they stay in the entry block
+        BasicBlock &entry = func->getEntryBlock();
+        auto position = entry.getFirstInsertionPt();
+        while ( llvm::isa<llvm::AllocaInst>(*position) ) { ++position; }
+
+        builder.SetInsertPoint(&entry, position);
+        llvm::Value *calls = Profile::increment(builder, &tier->calls, builder.getInt64(1));
+        llvm::Value *hot = builder.CreateICmpEQ(calls, builder.getInt64(threshold - 1));
+        llvm::Instruction *request = llvm::SplitBlockAndInsertIfThen(
+            hot, &*builder.GetInsertPoint(), false,
+            llvm::MDBuilder(context).createBranchWeights(1, threshold));
+        builder.SetInsertPoint(request);
+        builder.CreateCall(request_type,
+                           builder.CreateIntToPtr(
+                               builder.getInt64(reinterpret_cast<uintptr_t>(&request_promotion)),
+                               pointer_type),
+                           {builder.CreateIntToPtr(
+                               builder.getInt64(reinterpret_cast<uintptr_t>(tier.get())),
+                               pointer_type)});
+
+        // Callers, recursive calls included, go through the stub
+        func->setName(name + ".tier0");
+        Function *stub = Function::Create(func->getFunctionType(), Function::ExternalLinkage,
+                                          name, module);
+        stub->setAttributes(func->getAttributes());
+        func->replaceAllUsesWith(stub);
+        func->setMemoryEffects(llvm::MemoryEffects::unknown());
+
+        std::lock_guard<std::mutex> guard(lock);
+        functions[name] = std::move(tier);
+        names.push_back(name);
+    }
+    return names;
+}
+
+llvm::Error
+TierManager::create_stubs(llvm::orc::JITDylib &dylib, llvm::ArrayRef<std::string> names) {
+    // Pointed at their tier 0 body once it has an address
+    llvm::orc::IndirectStubsManager::StubInitsMap inits;
+    for ( auto &name : names ) {
+        inits[name] = {llvm::orc::ExecutorAddr(),
+                       llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable};
+    }
+    if (auto err = stubs->createStubs(inits)) { return err; }
+
+    llvm::orc::SymbolMap symbols;
+    for ( auto &name : names ) {
+        symbols[jit.mangleAndIntern(name)] = stubs->findStub(name, true);
+    }
+    return dylib.define(llvm::orc::absoluteSymbols(std::move(symbols)));
+}
+
+llvm::Error
+TierManager::redirect(llvm::StringRef name, llvm::orc::ExecutorAddr address) {
+    return stubs->updatePointer(name, address);
+}
+
+void
+TierManager::annotate(Function &func, const FunctionTier &tier) {
+    func.setEntryCount(tier.calls.load());
+
+    // Branches are met in the same order as when they were instrumented
+    unsigned index = 0;
+    llvm::MDBuilder metadata(func.getContext());
+    for ( auto &block : func ) {
+        auto *branch = llvm::dyn_cast<BranchInst>(block.getTerminator());
+        if ( !branch || !branch->isConditional() ) { continue; }
+        if ( index >= tier.branch_count ) { return; }
+
+        uint64_t executed = tier.branches[index].executed;
+        uint64_t taken = std::min(tier.branches[index].taken.load(), executed);
+        index++;
+        if ( executed == 0 ) { continue; }
+
+        // Weights are 32 bit
+        uint64_t scale = executed / std::numeric_limits<uint32_t>::max() + 1;
+        branch->setMetadata(llvm::LLVMContext::MD_prof,
+                            metadata.createBranchWeights(taken / scale,
+                                                         (executed - taken) / scale));
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class IRRenderer;
+class TierManager;
+
+
+struct BranchCounters {
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> taken{0};  // Towards the first successor
+};
+
+/// FunctionTier - the tier 0 counters of one function. Generated code
+/// holds their addresses.
+struct FunctionTier {
+    TierManager *manager;
+    std::string name;
+    unsigned arity = 0;
+    std::atomic<uint64_t> calls{0};
+    std::unique_ptr<BranchCounters[]> branches;
+    unsigned branch_count = 0;
+    std::atomic<bool> promoted{false};
+};
+
+/// TierManager - two tier execution for one session. Definitions are first
+/// compiled without optimization as "name.tier0", counting calls and
+/// branch directions, and called through an indirect stub named "name".
+/// When a function reaches the threshold, a background thread recompiles
+/// it at O3 as "name.tier1" with the counts as profile metadata and points
+/// the stub at the new code.
+class TierManager {
+    IRRenderer *renderer;
+    llvm::orc::LLJIT &jit;
+    unsigned threshold;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+
+    std::mutex lock;
+    llvm::StringMap<std::unique_ptr<FunctionTier> > functions;
+
+    std::condition_variable wake;
+    std::deque<FunctionTier*> queue;
+    bool stopping = false;
+    std::thread worker;
+
+    static void request_promotion(FunctionTier *tier);
+    void promote_queued();
+
+public:
+    TierManager(IRRenderer *renderer, llvm::orc::LLJIT &jit, unsigned threshold);
+    ~TierManager();
+
+    void rebind(IRRenderer *owner) { renderer = owner; }
+    void stop();
+
+    // Turn the definitions of a module into tier 0 bodies, returning the
+    // names that need a stub
+    std::vector<std::string> instrument(llvm::Module &module);
+    llvm::Error create_stubs(llvm::orc::JITDylib &dylib, llvm::ArrayRef<std::string> names);
+    llvm::Error redirect(llvm::StringRef name, llvm::orc::ExecutorAddr address);
+
+    // The tier 0 counts of a function, as metadata on its unoptimized body
+    void annotate(llvm::Function &func, const FunctionTier &tier);
+};
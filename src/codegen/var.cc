@@ -8,7 +8,6 @@
 #include "ast/var.h"
 #include "renderer.h"
 
-#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -21,12 +20,12 @@ using ::llvm::Value;
 
 Value *
 VarNode::codegen(IRRenderer *renderer) {
-    std::vector<AllocaInst *> old_bindings;
-
     Function *func = renderer->builder->GetInsertBlock()->getParent();
 
+    renderer->push_scope();
+
     for ( auto &var_pair : var_names) {
-        const std::string &var_name = var_pair.first;
+        Identifier var_name = var_pair.first;
         ASTNode *init = var_pair.second;
 
         Value *init_val;
@@ -37,21 +36,16 @@ VarNode::codegen(IRRenderer *renderer) {
             init_val = ConstantFP::get(renderer->llvm_context(), APFloat(0.0));
         }
 
-        AllocaInst *alloca = renderer->create_entry_block_alloca(func, var_name);
+        AllocaInst *alloca = renderer->create_entry_block_alloca(func, var_name.str());
         renderer->builder->CreateStore(init_val, alloca);
 
-        old_bindings.push_back(renderer->get_named_value(var_name));
         renderer->set_named_value(var_name, alloca);
     }
 
     Value *body_val = body->codegen(renderer);
     if ( body_val == 0 ) { return 0; }
 
-    std::size_t index = 0;
-    for ( auto &var_pair : var_names) {
-        renderer->set_named_value(var_pair.first, old_bindings[index]);
-        ++index;
-    }
+    renderer->pop_scope();
 
     return body_val;
 }
@@ -14,5 +14,5 @@ VariableNode::codegen(IRRenderer *renderer) {
     }
 
     llvm::AllocaInst *alloca = llvm::cast<llvm::AllocaInst>(val);
-    return renderer->builder->CreateLoad(alloca->getAllocatedType(), val, name.c_str());
+    return renderer->builder->CreateLoad(alloca->getAllocatedType(), val, name.str());
 }
@@ -0,0 +1,342 @@
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorAddress.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "codegen/renderer.h"
+#include "codegen/runtime.h"
+#include "codegen/stats.h"
+#include "parsing/tree.h"
+#include "engine.h"
+
+extern "C" double putchard(double X);
+extern "C" double printd(double X);
+
+
+namespace kscope {
+
+static llvm::Error
+make_error(const std::string &message) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), message);
+}
+
+/// compile_targets - a definition and the functions it calls directly, which
+/// are the likely next ones to be needed.
+static std::vector<std::string>
+compile_targets(llvm::Function *func) {
+    std::vector<std::string> targets = {func->getName().str()};
+    for ( auto &block : *func ) {
+        for ( auto &inst : block ) {
+            auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+            if ( call == 0 ) { continue; }
+
+            llvm::Function *callee = call->getCalledFunction();
+            if ( callee != 0 && !callee->isIntrinsic() ) {
+                targets.push_back(callee->getName().str());
+            }
+        }
+    }
+    return targets;
+}
+
+std::shared_ptr<JITRuntime>
+create_runtime(const RendererOptions &options) {
+    auto runtime = JITRuntime::create(options);
+
+    llvm::Error err = runtime->define_builtin("putchard", (void*)putchard, 1);
+    err = llvm::joinErrors(std::move(err), runtime->define_builtin("printd", (void*)printd, 1));
+    if ( err ) {
+        llvm::errs() << "Failed to register external symbols: " << err << "\n";
+        exit(1);
+    }
+    return runtime;
+}
+
+Engine::Engine(const RendererOptions &options) : Engine(create_runtime(options)) {}
+
+Engine::Engine(std::shared_ptr<JITRuntime> runtime)
+    : runtime(runtime),
+      options(runtime->options()),
+      renderer(std::make_unique<IRRenderer>(runtime)),
+      tree(std::make_unique<STree>()) {}
+
+Engine::~Engine() {
+    tree.reset();
+    renderer.reset();
+}
+
+llvm::Error
+Engine::flush_definitions() {
+    pending_definitions = 0;
+    return renderer->flush_definitions();
+}
+
+llvm::Error
+Engine::run_expressions(const Callbacks &callbacks) {
+    if ( pending_expressions.empty() ) { return llvm::Error::success(); }
+
+    std::vector<std::string> names;
+    for ( auto &expression : pending_expressions ) {
+        if ( !expression.name.empty() ) { names.push_back(expression.name); }
+    }
+
+    // Results in source order, folded ones in between those of the JIT
+    size_t next = 0;
+    auto report_folded = [&]() {
+        while ( next < pending_expressions.size() && pending_expressions[next].name.empty() ) {
+            double value = pending_expressions[next++].value;
+            if ( callbacks.result ) { callbacks.result(value); }
+        }
+    };
+
+    if ( !names.empty() ) {
+        auto err = renderer->evaluate(names, [&](double result) {
+            report_folded();
+            next++;
+            if ( callbacks.result ) { callbacks.result(result); }
+        });
+        if ( err ) {
+            pending_expressions.clear();
+            return err;
+        }
+    }
+    report_folded();
+    pending_expressions.clear();
+    return llvm::Error::success();
+}
+
+/// handle_statement - generate code for one parsed statement and group it
+/// with the pending ones. Definitions are handed to the JIT batch_size at a
+/// time, or all together before the next expression; expressions run as
+/// soon as a definition follows them or the source ends.
+llvm::Error
+Engine::handle_statement(ASTNode *root, const Callbacks &callbacks) {
+    FunctionNode *function = dynamic_cast<FunctionNode*>(root);
+    bool anonymous = function != 0 && function->is_anonymous();
+
+    // Expressions run from a module of their own that is freed afterwards,
+    // so definitions and expressions never share a module.
+    if ( anonymous && pending_definitions > 0 ) {
+        if (auto err = flush_definitions()) { return err; }
+    } else if ( !anonymous ) {
+        if (auto err = run_expressions(callbacks)) { return err; }
+    }
+
+    llvm::Value *value;
+    std::optional<double> folded;
+    {
+        // Compile threads may be cloning earlier modules of this context
+        auto lock = renderer->context.getLock();
+        {
+            PhaseTimer timer(runtime->stats(), Phase::Codegen);
+            value = root->codegen(renderer.get());
+        }
+
+        // Closed, pure expressions need no JIT at all
+        auto *func = llvm::dyn_cast_or_null<llvm::Function>(value);
+        if ( anonymous && func != 0 ) {
+            folded = renderer->fold_expression(*func);
+        }
+    }
+
+    // A folded expression was removed from the module along with its function
+    llvm::Function *func = folded ? 0 : llvm::dyn_cast_or_null<llvm::Function>(value);
+    if ( func == 0 && !folded ) { return make_error("could not compile statement"); }
+
+    if ( anonymous ) {
+        if ( folded ) {
+            pending_expressions.push_back({"", *folded});
+        } else {
+            pending_expressions.push_back({func->getName().str()});
+        }
+        if ( options.batch_size > 0 && pending_expressions.size() >= options.batch_size ) {
+            return run_expressions(callbacks);
+        }
+        return llvm::Error::success();
+    }
+
+    std::string func_name = func->getName().str();
+    if ( callbacks.definition ) { callbacks.definition(func_name); }
+    if ( func->isDeclaration() ) { return llvm::Error::success(); }
+
+    pending_definitions++;
+
+    // With compile threads, hand definitions to the JIT right away and start
+    // compiling them and their callees in the background.
+    if ( options.compile_threads > 0 ) {
+        std::vector<std::string> targets = compile_targets(func);
+        if (auto err = flush_definitions()) { return err; }
+        renderer->precompile(targets);
+    } else if ( options.batch_size > 0 && pending_definitions >= options.batch_size ) {
+        return flush_definitions();
+    }
+    return llvm::Error::success();
+}
+
+llvm::Error
+Engine::compile(std::string_view source, const Callbacks &callbacks) {
+    std::lock_guard<std::mutex> guard(session);
+
+    // A failed statement does not stop the ones after it
+    llvm::Error errors = llvm::Error::success();
+    std::optional<PhaseTimer> timer(std::in_place, runtime->stats(), Phase::Parse);
+    bool parsed = tree->parse(llvm::StringRef(source.data(), source.size()),
+                              [&](ASTNode *root) {
+        errors = llvm::joinErrors(std::move(errors), handle_statement(root, callbacks));
+    });
+    timer.reset();
+    errors = llvm::joinErrors(std::move(errors), run_expressions(callbacks));
+
+    if ( !parsed ) {
+        errors = llvm::joinErrors(std::move(errors), make_error("syntax error"));
+    }
+    return errors;
+}
+
+llvm::Expected<double>
+Engine::eval(std::string_view expression) {
+    std::vector<double> results;
+    Callbacks callbacks;
+    callbacks.result = [&results](double result) { results.push_back(result); };
+
+    if (auto err = compile(expression, callbacks)) { return err; }
+    if ( results.size() != 1 ) {
+        return make_error("not a single expression");
+    }
+    return results.front();
+}
+
+llvm::Expected<llvm::orc::ExecutorAddr>
+Engine::lookup_address(llvm::StringRef name, unsigned arity) {
+    std::lock_guard<std::mutex> guard(session);
+
+    if (auto err = flush_definitions()) { return err; }
+
+    std::optional<Signature> signature = renderer->signature(name);
+    if ( !signature || !signature->defined ) {
+        return make_error("unknown function " + name.str());
+    }
+    if ( signature->arity != arity ) {
+        return make_error(name.str() + " takes " + std::to_string(signature->arity) +
+                          " arguments, not " + std::to_string(arity));
+    }
+    return renderer->lookup(name);
+}
+
+llvm::Error
+Engine::load(const std::string &path) {
+    std::lock_guard<std::mutex> guard(session);
+    return renderer->load(path);
+}
+
+llvm::Error
+Engine::emit(std::string_view source, EmitKind kind, llvm::StringRef path) {
+    std::lock_guard<std::mutex> guard(session);
+
+    // Only this source goes into the emitted module; whatever the session
+    // generated before goes to the JIT as usual
+    if (auto err = flush_definitions()) { return err; }
+
+    // Nor do the emitted prototypes stay; they were never given to the JIT
+    SignatureTable saved_signatures = renderer->signature_snapshot();
+
+    // Keeps the context alive should the renderer move on to a new one
+    llvm::orc::ThreadSafeContext context = renderer->context;
+
+    // Top level expressions have nothing to run them and are skipped
+    llvm::Error errors = llvm::Error::success();
+    std::optional<PhaseTimer> timer(std::in_place, runtime->stats(), Phase::Parse);
+    bool parsed = tree->parse(llvm::StringRef(source.data(), source.size()),
+                              [&](ASTNode *root) {
+        FunctionNode *function = dynamic_cast<FunctionNode*>(root);
+        if ( function != 0 && function->is_anonymous() ) { return; }
+
+        // Compile threads may be cloning earlier modules of this context
+        auto lock = context.getLock();
+        PhaseTimer codegen_timer(runtime->stats(), Phase::Codegen);
+        if ( root->codegen(renderer.get()) == 0 ) {
+            errors = llvm::joinErrors(std::move(errors), make_error("could not compile statement"));
+        }
+    });
+    timer.reset();
+    if ( !parsed ) {
+        errors = llvm::joinErrors(std::move(errors), make_error("syntax error"));
+    }
+
+    auto lock = context.getLock();
+    std::unique_ptr<llvm::Module> emitted = renderer->detach_module();
+    renderer->restore_signatures(std::move(saved_signatures));
+    if ( errors ) { return errors; }
+
+    auto jtmb = runtime->target_machine_builder();
+    jtmb.setRelocationModel(llvm::Reloc::PIC_);
+    auto target = jtmb.createTargetMachine();
+    if ( !target ) { return target.takeError(); }
+
+    renderer->optimize_module(*emitted);
+    return emit_module(*emitted, **target, kind, path);
+}
+
+llvm::Expected<ArrayMap>
+Engine::array_map(const std::string &name) {
+    std::lock_guard<std::mutex> guard(session);
+    return renderer->array_map(name);
+}
+
+JITMemoryUsage
+Engine::memory_usage() {
+    std::lock_guard<std::mutex> guard(session);
+    return renderer->jit_memory_usage();
+}
+
+void
+Engine::print_pending(llvm::raw_ostream &out) {
+    std::lock_guard<std::mutex> guard(session);
+    renderer->module->print(out, nullptr);
+}
+
+void
+Engine::print_profile(llvm::raw_ostream &out, unsigned top) {
+    std::lock_guard<std::mutex> guard(session);
+    if ( Profile *profile = renderer->profile() ) {
+        profile->print(out, top);
+    } else {
+        out << "Profiling is off (-profile-counts, -profile-cycles)\n";
+    }
+}
+
+void
+Engine::reset_profile() {
+    std::lock_guard<std::mutex> guard(session);
+    if ( Profile *profile = renderer->profile() ) {
+        profile->reset();
+    }
+}
+
+}  // namespace kscope
+
+
+/// putchard - putchar that takes a double and returns 0.
+extern "C"
+double putchard(double X) {
+  putchar((char)X);
+  return 0;
+}
+
+/// printd - printf that takes a double prints it as "%f\n", returning 0.
+extern "C"
+double printd(double X) {
+  printf("%f\n", X);
+  return 0;
+}
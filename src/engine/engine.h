@@ -0,0 +1,119 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/Shared/ExecutorAddress.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "codegen/array_map.h"
+#include "codegen/emitter.h"
+#include "codegen/memory_plugin.h"
+#include "codegen/options.h"
+
+class ASTNode;
+class IRRenderer;
+class JITRuntime;
+class STree;
+
+
+namespace kscope {
+
+template <typename Sig>
+struct FunctionArity;
+
+template <typename... Args>
+struct FunctionArity<double(Args...)> {
+    static_assert((std::is_same<Args, double>::value && ...),
+                  "kscope functions take and return doubles");
+    static constexpr unsigned value = sizeof...(Args);
+};
+
+/// create_runtime - a JIT runtime with the kscope builtins (putchard,
+/// printd) in its prelude, to be shared by any number of engines.
+std::shared_ptr<JITRuntime> create_runtime(const RendererOptions &options = RendererOptions());
+
+/// Engine - one kscope session: everything compiled into it can call
+/// everything defined before, and the builtins and libraries in the prelude
+/// of its runtime. Engines on one runtime share compile threads and the
+/// object cache but not their definitions. All calls are serialized on a
+/// per-session lock, so an engine may be shared between threads. Function
+/// pointers handed out stay valid for the lifetime of the engine and may be
+/// called without the lock.
+class Engine {
+public:
+    struct Callbacks {
+        // After each def or extern, with its name
+        std::function<void(llvm::StringRef)> definition;
+        // With the value of each top level expression, in source order
+        std::function<void(double)> result;
+    };
+
+private:
+    std::mutex session;
+    std::shared_ptr<JITRuntime> runtime;
+    RendererOptions options;
+    std::unique_ptr<IRRenderer> renderer;
+    std::unique_ptr<STree> tree;
+
+    // Generated into the current module but not yet handed to the JIT;
+    // expressions folded at compile time only wait for their turn
+    struct PendingExpression {
+        std::string name;  // Empty when folded
+        double value = 0;
+    };
+    unsigned pending_definitions = 0;
+    std::vector<PendingExpression> pending_expressions;
+
+    llvm::Error handle_statement(ASTNode *root, const Callbacks &callbacks);
+    llvm::Error flush_definitions();
+    llvm::Error run_expressions(const Callbacks &callbacks);
+    llvm::Expected<llvm::orc::ExecutorAddr> lookup_address(llvm::StringRef name,
+                                                           unsigned arity);
+
+public:
+    explicit Engine(const RendererOptions &options = RendererOptions());
+    explicit Engine(std::shared_ptr<JITRuntime> runtime);
+    ~Engine();
+
+    Engine(const Engine &) = delete;
+    Engine &operator =(const Engine &) = delete;
+
+    /// Compile a sequence of ;-separated statements. Top level expressions
+    /// are run once everything before them is compiled.
+    llvm::Error compile(std::string_view source, const Callbacks &callbacks = Callbacks());
+
+    /// Compile and run a single top level expression.
+    llvm::Expected<double> eval(std::string_view expression);
+
+    /// Address of a compiled function, typed as e.g. double(double, double).
+    template <typename Sig>
+    llvm::Expected<Sig*> lookup(llvm::StringRef name) {
+        auto address = lookup_address(name, FunctionArity<Sig>::value);
+        if ( !address ) { return address.takeError(); }
+
+        return address->template toPtr<Sig*>();
+    }
+
+    llvm::Error load(const std::string &path);
+    llvm::Error emit(std::string_view source, EmitKind kind, llvm::StringRef path);
+    llvm::Expected<ArrayMap> array_map(const std::string &name);
+    JITMemoryUsage memory_usage();
+
+    // Print the module that is still being generated
+    void print_pending(llvm::raw_ostream &out);
+
+    // With options.profile: the hottest functions and loops so far, and
+    // clearing the counters
+    void print_profile(llvm::raw_ostream &out, unsigned top = 10);
+    void reset_profile();
+};
+
+}  // namespace kscope
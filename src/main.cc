@@ -1,62 +1,335 @@
-#include "llvm/ADT/APFloat.h"
-#include "llvm/ADT/STLExtras.h"
-#include "llvm/IR/BasicBlock.h"
-#include "llvm/IR/Constants.h"
-#include "llvm/IR/DerivedTypes.h"
-#include "llvm/IR/Function.h"
-#include "llvm/IR/IRBuilder.h"
-#include "llvm/IR/Instructions.h"
-#include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
-#include "llvm/IR/Module.h"
-#include "llvm/IR/Type.h"
-#include "llvm/IR/Verifier.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetSelect.h"
-#include "llvm/Target/TargetMachine.h"
-#include "llvm/ExecutionEngine/Orc/LLJIT.h"
-#include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/DynamicLibrary.h"
-#include "llvm/Transforms/Utils/Cloning.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
-#include <sstream>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <system_error>
 
-#include "codegen/renderer.h"
-#include "parsing/tree.h"
+#include "codegen/emitter.h"
+#include "codegen/runtime.h"
+#include "codegen/stats.h"
+#include "engine/engine.h"
 
-// Forward declarations
-extern "C" double putchard(double X);
-extern "C" double printd(double X);
+static llvm::cl::opt<char> opt_level(
+    "O",
+    llvm::cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] (default = '-O2')"),
+    llvm::cl::Prefix,
+    llvm::cl::init('2'));
+
+// -inline-threshold is LLVM's own option and overrides the inliner's
+static llvm::cl::opt<unsigned> import_threshold(
+    "import-threshold",
+    llvm::cl::desc("Import callees up to this many instructions from earlier modules for inlining, 0 = off (default = 100)"),
+    llvm::cl::init(100));
+
+static llvm::cl::opt<uint64_t> fold_budget(
+    "fold-budget",
+    llvm::cl::desc("Instructions to spend evaluating a top level expression at compile time, 0 = off (default = 100000)"),
+    llvm::cl::init(100000));
+
+static llvm::cl::opt<std::string> target_cpu(
+    "mcpu",
+    llvm::cl::desc("Target CPU for the JIT (default = host CPU)"),
+    llvm::cl::value_desc("cpu-name"));
+
+static llvm::cl::opt<std::string> target_features(
+    "mattr",
+    llvm::cl::desc("Target features added to the host features (e.g. +avx2,-fma)"),
+    llvm::cl::value_desc("a1,+a2,-a3,..."));
+
+static llvm::cl::opt<int> codegen_opt_level(
+    "codegen-opt",
+    llvm::cl::desc("Backend optimization level 0-3 (default = same as -O)"),
+    llvm::cl::init(-1));
+
+static llvm::cl::opt<bool> fp_contract(
+    "fp-contract",
+    llvm::cl::desc("Allow fusing floating point multiply-adds (default = true)"),
+    llvm::cl::init(true));
+
+static llvm::cl::opt<bool> lazy(
+    "lazy",
+    llvm::cl::desc("Compile each function on its first call (LLLazyJIT)"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> compile_threads(
+    "compile-threads",
+    llvm::cl::desc("Compile definitions in the background on this many threads (default = 0)"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<unsigned> batch_size(
+    "batch-size",
+    llvm::cl::desc("Definitions per JIT module, 0 groups everything up to the next expression (default = 0)"),
+    llvm::cl::init(0));
+
+static llvm::cl::list<std::string> load_files(
+    "load",
+    llvm::cl::desc("Preload definitions from an object (-emit=obj) or bitcode file"),
+    llvm::cl::value_desc("file"));
+
+static llvm::cl::opt<EmitKind> emit(
+    "emit",
+    llvm::cl::desc("Compile the input ahead of time instead of running it"),
+    llvm::cl::values(
+        clEnumValN(EmitKind::Object, "obj", "Native object file"),
+        clEnumValN(EmitKind::SharedLibrary, "so", "Shared library (linked with cc)"),
+        clEnumValN(EmitKind::Assembly, "asm", "Native assembly"),
+        clEnumValN(EmitKind::IR, "llvm-ir", "Textual LLVM IR"),
+        clEnumValN(EmitKind::Bitcode, "bc", "LLVM bitcode")));
+
+static llvm::cl::opt<std::string> output_file(
+    "o",
+    llvm::cl::desc("Output file for -emit (default = stdout)"),
+    llvm::cl::value_desc("filename"),
+    llvm::cl::init("-"));
+
+static llvm::cl::opt<std::string> input_file(
+    llvm::cl::Positional,
+    llvm::cl::desc("[<file> | -]  (run a whole file, or stdin, in batch mode)"),
+    llvm::cl::init(""));
+
+static llvm::cl::opt<std::string> object_cache_dir(
+    "object-cache",
+    llvm::cl::desc("Reuse compiled objects from this directory across runs"),
+    llvm::cl::value_desc("directory"));
+
+// -stats and -time-passes are LLVM's own options; they enable the phase
+// report and the per-pass timers
+static llvm::cl::opt<bool> perf(
+    "perf",
+    llvm::cl::desc("Write /tmp/perf-<pid>.map and jitdump records for perf"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> jit_debug(
+    "jit-debug",
+    llvm::cl::desc("Register JIT code with the GDB JIT interface (gdb, lldb)"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> profile_counts(
+    "profile-counts",
+    llvm::cl::desc("Count calls and loop iterations of generated code (REPL: profile;)"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> profile_cycles(
+    "profile-cycles",
+    llvm::cl::desc("Like -profile-counts, also counting cycles spent in every function"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> tiered(
+    "tiered",
+    llvm::cl::desc("Run definitions unoptimized first, recompile hot ones at O3 with their profile"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> tier_threshold(
+    "tier-threshold",
+    llvm::cl::desc("Calls before -tiered recompiles a function (default = 1000)"),
+    llvm::cl::init(1000));
+
+static llvm::cl::opt<std::string> stats_file(
+    "stats-file",
+    llvm::cl::desc("Write the -stats report as JSON to this file on exit"),
+    llvm::cl::value_desc("filename"));
+
+/// statement_end - offset of the ';' that ends the first statement of
+/// text, skipping '#' comments as the lexer does, or npos.
+static size_t
+statement_end(const std::string &text) {
+    bool comment = false;
+    for ( size_t i = 0; i < text.size(); i++ ) {
+        if ( comment ) {
+            comment = text[i] != '\n';
+        } else if ( text[i] == '#' ) {
+            comment = true;
+        } else if ( text[i] == ';' ) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+/// read_statement - the next statement typed at the REPL, without its ';'.
+/// Lines are read until one completes it; the rest stays in pending. At
+/// the end of input whatever is left counts as the last statement.
+static bool
+read_statement(std::string &pending, std::string &statement) {
+    size_t end;
+    std::string line;
+    while ( ( end = statement_end(pending) ) == std::string::npos ) {
+        if ( !std::getline(std::cin, line) ) {
+            statement = std::move(pending);
+            pending.clear();
+            return statement.find_first_not_of(" \t\n\r") != std::string::npos;
+        }
+        pending += line;
+        pending += '\n';
+    }
+    statement = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return true;
+}
+
+/// read_input - map a whole input file, or stdin for "-".
+static std::unique_ptr<llvm::MemoryBuffer>
+read_input(const std::string &path) {
+    auto buffer = llvm::MemoryBuffer::getFileOrSTDIN(path);
+    if ( !buffer ) {
+        llvm::errs() << "Failed to read " << path << ": "
+                     << buffer.getError().message() << "\n";
+        exit(1);
+    }
+    return std::move(*buffer);
+}
+
+static std::string_view
+contents(const llvm::MemoryBuffer &buffer) {
+    return std::string_view(buffer.getBufferStart(), buffer.getBufferSize());
+}
+
+/// report_stats - print the phase report of -stats, and write it as JSON
+/// to -stats-file.
+static void
+report_stats(JITRuntime &runtime) {
+    CompileStats *stats = runtime.stats();
+    if ( stats == nullptr ) { return; }
+
+    if ( llvm::AreStatisticsEnabled() ) {
+        stats->print(llvm::errs(), runtime.memory_usage());
+    }
+    if ( !stats_file.empty() ) {
+        std::error_code error;
+        llvm::raw_fd_ostream out(stats_file, error);
+        if ( error ) {
+            llvm::errs() << "Failed to write " << stats_file << ": " << error.message() << "\n";
+            return;
+        }
+        stats->print_json(out, runtime.memory_usage());
+    }
+}
+
+static void
+report_errors(llvm::Error err) {
+    llvm::handleAllErrors(std::move(err), [](const llvm::ErrorInfoBase &E) {
+        llvm::errs() << "Error: " << E.message() << "\n";
+    });
+}
+
+int main(int argc, char **argv) {
+    llvm::cl::ParseCommandLineOptions(argc, argv, "kscope - Kaleidoscope JIT\n");
+
+    if ( opt_level < '0' || opt_level > '3' ) {
+        llvm::errs() << "Invalid optimization level: -O" << opt_level << "\n";
+        return 1;
+    }
+
+    if ( codegen_opt_level > 3 ) {
+        llvm::errs() << "Invalid backend optimization level: " << codegen_opt_level << "\n";
+        return 1;
+    }
 
-int main() {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
 
-    IRRenderer *renderer = new IRRenderer();
+    RendererOptions options;
+    options.opt_level = opt_level - '0';
+    options.import_threshold = import_threshold;
+    options.fold_budget = fold_budget;
+    options.cpu = target_cpu;
+    options.features = target_features;
+    options.codegen_opt_level = codegen_opt_level;
+    options.fp_contract = fp_contract;
+    options.lazy = lazy;
+    options.compile_threads = compile_threads;
+    options.object_cache_dir = object_cache_dir;
+    options.batch_size = batch_size;
+    options.stats = llvm::AreStatisticsEnabled() || !stats_file.empty();
+    options.time_passes = llvm::TimePassesIsEnabled;
+    options.perf = perf;
+    options.debugger = jit_debug;
+    options.profile = profile_counts || profile_cycles;
+    options.profile_cycles = profile_cycles;
+    options.tiered = tiered;
+    options.tier_threshold = tier_threshold;
+
+    if ( tiered && lazy ) {
+        llvm::errs() << "-tiered and -lazy both decide when functions are compiled; pick one\n";
+        return 1;
+    }
+
+    // Preloaded libraries go into the prelude of the runtime, where any
+    // engine created on it can call them
+    auto runtime = kscope::create_runtime(options);
+    for ( auto &path : load_files ) {
+        if (auto err = runtime->load_prelude(path)) {
+            llvm::errs() << "Failed to load " << path << ": "
+                         << llvm::toString(std::move(err)) << "\n";
+            return 1;
+        }
+    }
 
-    // Register external functions with JIT using SymbolMap
-    auto &es = renderer->engine->getExecutionSession();
-    auto &jd = renderer->engine->getMainJITDylib();
+    kscope::Engine engine(runtime);
 
-    llvm::orc::SymbolMap symbolMap;
-    auto putchardAddr = llvm::orc::ExecutorAddr(reinterpret_cast<uintptr_t>(putchard));
-    auto printdAddr = llvm::orc::ExecutorAddr(reinterpret_cast<uintptr_t>(printd));
-    symbolMap[es.intern("putchard")] = llvm::orc::ExecutorSymbolDef(putchardAddr, llvm::JITSymbolFlags::Callable);
-    symbolMap[es.intern("printd")] = llvm::orc::ExecutorSymbolDef(printdAddr, llvm::JITSymbolFlags::Callable);
+    kscope::Engine::Callbacks callbacks;
+    callbacks.definition = [](llvm::StringRef name) {
+        fprintf(stderr, "Read %s definition\n", name.str().c_str());
+    };
+    callbacks.result = [](double result) {
+        fprintf(stderr, "Evaluated to: %f\n", result);
+    };
 
-    if (auto err = jd.define(llvm::orc::absoluteSymbols(symbolMap))) {
-        llvm::errs() << "Failed to register external symbols: " << err << "\n";
-        exit(1);
+    if ( emit.getNumOccurrences() > 0 ) {
+        if ( options.profile ) {
+            llvm::errs() << "Profile counters only exist in the running process; not with -emit\n";
+            return 1;
+        }
+        if ( options.tiered ) {
+            llvm::errs() << "-tiered only applies to the JIT; not with -emit\n";
+            return 1;
+        }
+        if ( emit == EmitKind::SharedLibrary && output_file == "-" ) {
+            llvm::errs() << "-emit=so needs an output file (-o)\n";
+            return 1;
+        }
+
+        std::string path = input_file.empty() ? "-" : input_file.getValue();
+        std::unique_ptr<llvm::MemoryBuffer> buffer = read_input(path);
+        if (auto err = engine.emit(contents(*buffer), emit, output_file)) {
+            report_errors(std::move(err));
+            report_stats(*runtime);
+            return 1;
+        }
+        report_stats(*runtime);
+        return 0;
     }
 
-    STree *tree = new STree();
+    // Batch mode: lex and parse the whole (mapped) input in one pass
+    if ( !input_file.empty() ) {
+        std::unique_ptr<llvm::MemoryBuffer> buffer = read_input(input_file);
+        if (auto err = engine.compile(contents(*buffer), callbacks)) {
+            report_errors(std::move(err));
+            report_stats(*runtime);
+            return 1;
+        }
+        if ( options.profile ) {
+            engine.print_profile(llvm::errs());
+        }
+        report_stats(*runtime);
+        return 0;
+    }
 
     std::string input;
+    std::string pending;
     fprintf(stderr, "ready> ");
-    while (std::getline(std::cin, input, ';')) {
+    while (read_statement(pending, input)) {
         // Trim whitespace
         input.erase(0, input.find_first_not_of(" \t\n\r"));
         input.erase(input.find_last_not_of(" \t\n\r") + 1);
@@ -74,78 +347,55 @@ int main() {
             break;
         }
 
-        std::istringstream iss(input);
-
-        tree->parse(iss);
-        if ( tree->root != 0 ) {
-            llvm::Value *value = tree->root->codegen(renderer);
-            if ( value != 0 ) {
-                llvm::Function *func = llvm::dyn_cast<llvm::Function>(value);
-                if ( func != 0 ) {
-                    std::string func_name = func->getName().str();
-                    if ( func_name.substr(0, 11) == "__anon_expr" ) {
-                        // This is an anonymous expression, JIT and execute it
-                        // Collect function types before moving module
-                        renderer->reset_function_types();
-
-                        // Add the module to the JIT
-                        auto tsm = llvm::orc::ThreadSafeModule(
-                            std::move(renderer->module),
-                            std::move(renderer->context)
-                        );
-                        if (auto err = renderer->engine->addIRModule(std::move(tsm))) {
-                            llvm::handleAllErrors(std::move(err), [](const llvm::ErrorInfoBase &E) {
-                                llvm::errs() << "Failed to add module: " << E.message() << "\n";
-                            });
-                            continue;
-                        }
-
-                        // Lookup the function with its actual name
-                        auto sym = renderer->engine->lookup(func_name);
-                        if (!sym) {
-                            llvm::handleAllErrors(sym.takeError(), [](const llvm::ErrorInfoBase &E) {
-                                llvm::errs() << "Failed to lookup function: " << E.message() << "\n";
-                            });
-                            continue;
-                        }
-
-                        double (*func_pointer)() = (double(*)())(intptr_t)sym->getValue();
-                        fprintf(stderr, "Evaluated to: %f\n", func_pointer());
-
-                        // Create a new module for next iteration
-                        renderer->context = std::make_unique<llvm::LLVMContext>();
-                        renderer->module = std::make_unique<llvm::Module>("my cool jit", *renderer->context);
-                        renderer->builder = std::make_unique<llvm::IRBuilder<>>(*renderer->context);
-
-                        // Redefine external functions that were registered with JIT
-                        renderer->declare_external_function("putchard");
-                        renderer->declare_external_function("printd");
-                    } else {
-                        // This is a function definition or extern declaration
-                        // Don't JIT it, just keep it in the module for later use
-                        fprintf(stderr, "Read %s definition\n", func_name.c_str());
-                    }
-                }
+        if (lower_input == "stats") {
+            if ( CompileStats *stats = runtime->stats() ) {
+                stats->print(llvm::errs(), runtime->memory_usage());
+            } else {
+                JITMemoryUsage usage = engine.memory_usage();
+                fprintf(stderr, "JIT code: %zu bytes, data: %zu bytes\n",
+                        usage.code_bytes, usage.data_bytes);
             }
+            fprintf(stderr, "ready> ");
+            continue;
+        }
+
+        if (lower_input == "profile") {
+            engine.print_profile(llvm::errs());
+            fprintf(stderr, "ready> ");
+            continue;
+        }
+
+        if (lower_input == "profile reset") {
+            engine.reset_profile();
+            fprintf(stderr, "ready> ");
+            continue;
+        }
+
+        // map <name>: compile an element wise array entry point for name
+        if (lower_input.compare(0, 4, "map ") == 0) {
+            std::string name = input.substr(4);
+            name.erase(0, name.find_first_not_of(" \t\n\r"));
+
+            auto mapped = engine.array_map(name);
+            if ( mapped ) {
+                fprintf(stderr, "Compiled %s_map over %u arrays\n",
+                        name.c_str(), mapped->inputs());
+            } else {
+                llvm::errs() << "Failed to compile " << name << "_map: "
+                             << llvm::toString(mapped.takeError()) << "\n";
+            }
+            fprintf(stderr, "ready> ");
+            continue;
+        }
+
+        if (auto err = engine.compile(input, callbacks)) {
+            report_errors(std::move(err));
         }
         fprintf(stderr, "ready> ");
     }
 
-    renderer->module->print(llvm::errs(), nullptr);
+    engine.print_pending(llvm::errs());
+    report_stats(*runtime);
 
     return 0;
 }
-
-/// putchard - putchar that takes a double and returns 0.
-extern "C"
-double putchard(double X) {
-  putchar((char)X);
-  return 0;
-}
-
-/// printd - printf that takes a double prints it as "%f\n", returning 0.
-extern "C"
-double printd(double X) {
-  printf("%f\n", X);
-  return 0;
-}
\ No newline at end of file
@@ -8,7 +8,10 @@
 %define api.namespace {bison}
 
 %code requires{
+    #include "llvm/ADT/SmallVector.h"
+
     #include "ast.h"
+    #include "ast/arena.h"
     #include "tree.h"
 
     class Lexer;
@@ -26,29 +29,27 @@ static int yylex(bison::Parser::semantic_type *yylval,
 static int anon_expr_counter = 0;
 }
 
+// Everything below lives in the tree's arena, so nothing is freed on
+// error recovery; the arena is released as a whole on the next parse.
 %union {
-    std::string *str;
+    Identifier id;
     ASTNode *node;
     PrototypeNode *proto;
     FunctionNode *func;
     double num;
     char chr;
-    std::vector<std::string> *strs;
-    std::vector<ASTNode*> *nodes;
-    std::pair<std::string, ASTNode*> *declr;
-    std::vector<std::pair<std::string, ASTNode*> > *declrs;
+    llvm::SmallVector<Identifier, 4> *ids;
+    llvm::SmallVector<ASTNode*, 4> *nodes;
+    VarNode::Declaration *declr;
+    llvm::SmallVector<VarNode::Declaration, 4> *declrs;
 }
 
-%destructor {
-    if ($$)  { delete ($$); ($$) = nullptr; }
-} <str> <node> <proto> <func> <strs>
-
 %define api.token.prefix {}
 
 %token END 0
 %token DEF "def"
 %token EXTERN "extern"
-%token <str> IDENTIFIER
+%token <id> IDENTIFIER
 %token <num> NUMBER
 
 %token <chr> ASSIGNMENT "="
@@ -76,7 +77,7 @@ static int anon_expr_counter = 0;
 %type <nodes> call_args
 %type <node> if_then for_loop var_declare
 %type <proto> prototype extern
-%type <strs> arg_names
+%type <ids> arg_names
 %type <func> definition
 %type <declrs> declarations
 %type <declr> declaration
@@ -85,12 +86,26 @@ static int anon_expr_counter = 0;
 %start top;
 
 top :
-  definition END { tree.set_root($1); }
-| extern END { tree.set_root($1); }
-| expr END {
+  statements END
+
+// Statements are separated by ";" and may be empty, so both a single
+// statement without a terminator and a whole file of them parse here.
+statements :
+  statement
+| statements ";" statement
+
+// A statement with a syntax error is skipped up to the next ";", so the
+// ones after it still run
+statement :
+  %empty
+| error { yyerrok; }
+| definition { tree.set_root($1); }
+| extern { tree.set_root($1); }
+| expr {
     std::string anon_name = "__anon_expr_" + std::to_string(anon_expr_counter++);
-    PrototypeNode *proto = new PrototypeNode(anon_name, std::vector<std::string>());
-    tree.set_root(new FunctionNode(proto, $1));
+    PrototypeNode *proto = tree.arena.make<PrototypeNode>(tree.arena.intern(anon_name),
+                                                          llvm::ArrayRef<Identifier>());
+    tree.set_root(tree.arena.make<FunctionNode>(proto, $1));
 }
 
 expr :
@@ -104,10 +119,10 @@ expr :
 | "(" expr ")" { $$ = $2; }
 
 variable:
-  IDENTIFIER { $$ = new VariableNode(*$1); }
+  IDENTIFIER { $$ = tree.arena.make<VariableNode>($1); }
 
 number_literal :
-  NUMBER { $$ = new NumberNode($1); }
+  NUMBER { $$ = tree.arena.make<NumberNode>($1); }
 
 %right "in";
 %left "=";
@@ -116,27 +131,27 @@ number_literal :
 %left "*" "/";
 
 binary_op :
-  expr "=" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr "+" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr "-" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr "*" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr "/" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr "<" expr { $$ = new BinaryNode($2, $1, $3); }
-| expr ">" expr { $$ = new BinaryNode($2, $1, $3); }
+  expr "=" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr "+" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr "-" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr "*" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr "/" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr "<" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
+| expr ">" expr { $$ = tree.arena.make<BinaryNode>($2, $1, $3); }
 
 call :
 IDENTIFIER "(" call_args ")" {
-  $$ = new CallNode(*$1, *$3);
+  $$ = tree.arena.make<CallNode>($1, tree.arena.copy<ASTNode*>(*$3));
 }
 
 call_args :
-  { $$ = new std::vector<ASTNode*>(); }
+  { $$ = tree.arena.make<llvm::SmallVector<ASTNode*, 4> >(); }
 | call_args "," expr {
     $$ = $1;
     $$->push_back($3);
   }
 | expr {
-    $$ = new std::vector<ASTNode*>();
+    $$ = tree.arena.make<llvm::SmallVector<ASTNode*, 4> >();
     $$->push_back($1);
   }
 
@@ -145,23 +160,23 @@ extern :
 
 definition :
 "def" prototype expr {
-    $$ = new FunctionNode($2, $3);
+    $$ = tree.arena.make<FunctionNode>($2, $3);
 }
 
 prototype :
 IDENTIFIER "(" arg_names ")" {
-    $$ = new PrototypeNode(*$1, *$3);
+    $$ = tree.arena.make<PrototypeNode>($1, tree.arena.copy<Identifier>(*$3));
 }
 
 arg_names:
-  { $$ = new std::vector<std::string>(); }
+  { $$ = tree.arena.make<llvm::SmallVector<Identifier, 4> >(); }
 | arg_names "," IDENTIFIER {
     $$ = $1;
-    $$->push_back(*$3);
+    $$->push_back($3);
   }
 | IDENTIFIER {
-    $$ = new std::vector<std::string>();
-    $$->push_back(*$1);
+    $$ = tree.arena.make<llvm::SmallVector<Identifier, 4> >();
+    $$->push_back($1);
   }
 
 %right ",";
@@ -169,43 +184,43 @@ arg_names:
 
 if_then :
   "if" expr "then" expr "else" expr {
-    $$ = new IfNode($2, $4, $6);
+    $$ = tree.arena.make<IfNode>($2, $4, $6);
   }
 
 for_loop :
   "for" IDENTIFIER "=" expr "," expr "in" expr {
-    $$ = new ForNode(*$2, $4, $6, 0, $8);
+    $$ = tree.arena.make<ForNode>($2, $4, $6, nullptr, $8);
   }
 | "for" IDENTIFIER "=" expr "," expr "," expr "in" expr {
-    $$ = new ForNode(*$2, $4, $6, $8, $10);
+    $$ = tree.arena.make<ForNode>($2, $4, $6, $8, $10);
   }
 
 
 var_declare :
   "var" declarations "in" expr {
-    $$ = new VarNode(*$2, $4);
+    $$ = tree.arena.make<VarNode>(tree.arena.copy<VarNode::Declaration>(*$2), $4);
   }
 
 declarations :
   {
-    $$ = new std::vector<std::pair<std::string, ASTNode*> >();
+    $$ = tree.arena.make<llvm::SmallVector<VarNode::Declaration, 4> >();
   }
 | declarations "," declaration {
     $$ = $1;
     $$->push_back(*$3);
   }
 | declaration {
-    $$ = new std::vector<std::pair<std::string, ASTNode*> >();
+    $$ = tree.arena.make<llvm::SmallVector<VarNode::Declaration, 4> >();
     $$->push_back(*$1);
   }
 
 
 declaration :
   IDENTIFIER "=" expr {
-    $$ = new std::pair<std::string, ASTNode*>(*$1, $3);
+    $$ = tree.arena.make<VarNode::Declaration>($1, $3);
   }
 | IDENTIFIER {
-    $$ = new std::pair<std::string, ASTNode*>(*$1, 0);
+    $$ = tree.arena.make<VarNode::Declaration>($1, nullptr);
   }
 
 %%
@@ -219,5 +234,6 @@ static int yylex(bison::Parser::semantic_type *yylval,
 void
 bison::Parser::error( const std::string &err_message )
 {
-   std::cerr << "Error: " << err_message << "\n";
+   std::cerr << "Error: line " << lexer.lineno() << ": " << err_message << "\n";
+   tree.syntax_errors++;
 }
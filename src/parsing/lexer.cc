@@ -1,9 +1,30 @@
+#include "ast/arena.h"
 #include "lexer.h"
 #include "bison_parser.hh"
 
+#include <algorithm>
+#include <cstring>
 
-Lexer::Lexer(std::istream *in)
-    : yyFlexLexer(in), yylval(nullptr) {}
+
+Lexer::Lexer(std::istream *in, ASTArena &arena)
+    : yyFlexLexer(in), yylval(nullptr), arena(arena),
+      source(nullptr), source_end(nullptr) {}
+
+Lexer::Lexer(llvm::StringRef source, ASTArena &arena)
+    : yyFlexLexer(), yylval(nullptr), arena(arena),
+      source(source.begin()), source_end(source.end()) {}
+
+int
+Lexer::LexerInput(char *buf, int max_size) {
+    if ( source == nullptr ) {
+        return yyFlexLexer::LexerInput(buf, max_size);
+    }
+
+    size_t count = std::min<size_t>(max_size, source_end - source);
+    memcpy(buf, source, count);
+    source += count;
+    return count;
+}
 
 int
 Lexer::yylex(bison::Parser::semantic_type *l_val) {
@@ -7,15 +7,28 @@
 #undef  YY_DECL
 #define YY_DECL int Lexer::yylex()
 
+#include "llvm/ADT/StringRef.h"
+
 #include "bison_parser.hh"
 
+class ASTArena;
+
 
 class Lexer : public yyFlexLexer {
     int yylex();
     bison::Parser::semantic_type *yylval;
+    ASTArena &arena;
+
+    // Set when lexing straight from memory instead of a stream
+    const char *source;
+    const char *source_end;
+
+protected:
+    int LexerInput(char *buf, int max_size) override;
 
 public:
-    Lexer(std::istream *in);
+    Lexer(std::istream *in, ASTArena &arena);
+    Lexer(llvm::StringRef source, ASTArena &arena);
 
     int yylex(bison::Parser::semantic_type *l_val);
 };
@@ -1,4 +1,7 @@
 %{
+#include "llvm/ADT/StringRef.h"
+
+#include "ast/arena.h"
 #include "bison_parser.hh"
 #include "lexer.h"
 
@@ -16,13 +19,14 @@ typedef bison::Parser::token token;
 %option noyywrap
 %option outfile="flex_lexer.cc"
 
-blank      [ \t]
+blank      [ \t\r]
 identifier [a-zA-Z_][a-zA-Z_0-9]*
 numeric    [0-9]+(\.[0-9][0-9]?)?
 
 %%
 
 {blank}+  /* skip whitespace */
+<INITIAL>\n yylineno++;
 
 "def"    return token::DEF;
 "extern" return token::EXTERN;
@@ -48,7 +52,7 @@ numeric    [0-9]+(\.[0-9][0-9]?)?
 "<" { yylval->chr = *yytext; return token::LESS_THAN; }
 
 {identifier} {
-    yylval->str = new std::string( yytext );
+    yylval->id = arena.intern(llvm::StringRef(yytext, yyleng));
     return token::IDENTIFIER;
 }
 
@@ -7,38 +7,54 @@
 
 STree::STree() : root(nullptr) {}
 
-STree::STree(STree &&other) {
-    root = std::move(other.root);
-    other.root = nullptr;
-}
-
-STree &
-STree::operator =(STree other) {
-    std::swap(root, other.root);
-    return *this;
-}
-
 STree::~STree() {
-    root.reset();
+    root = nullptr;
 }
 
 void
 STree::parse(std::istream &input) {
-    root.release();
+    root = nullptr;
+    syntax_errors = 0;
+    arena.reset();
+
+    Lexer lexer(&input, arena);
+    bison::Parser parser(lexer, *this);
+
+    parser.parse();
+}
+
+bool
+STree::parse(llvm::StringRef source, std::function<void(ASTNode*)> handle) {
+    root = nullptr;
+    syntax_errors = 0;
+    arena.reset();
+    handler = std::move(handle);
 
-    Lexer lexer = Lexer(&input);
-    bison::Parser *parser = new bison::Parser(lexer,
-                                              *this);
+    Lexer lexer(source, arena);
+    bison::Parser parser(lexer, *this);
 
-    parser->parse();
+    int status = parser.parse();
+    handler = nullptr;
+    return status == 0 && syntax_errors == 0;
 }
 
 void
 STree::set_root(FunctionNode *node) {
-    root = unique_ptr<ASTNode>(node);
+    root = node;
+    if ( handler ) { flush_root(); }
 }
 
 void
 STree::set_root(PrototypeNode *node) {
-    root = unique_ptr<ASTNode>(node);
+    root = node;
+    if ( handler ) { flush_root(); }
+}
+
+void
+STree::flush_root() {
+    handler(root);
+    root = nullptr;
+
+    // Only the lookahead token is still live, and identifiers are kept
+    arena.reset_nodes();
 }
@@ -1,19 +1,37 @@
 #pragma once
 
+#include <functional>
+
+#include "llvm/ADT/StringRef.h"
+
 #include "ast.h"
+#include "ast/arena.h"
 
 
+/// STree - the result of parsing one statement. Nodes and identifiers are
+/// owned by the arena and stay valid until the next call to parse().
+///
+/// With a handler, a whole buffer of statements is parsed in one pass and
+/// each statement is handed over as soon as it is reduced; its nodes are
+/// released right after the handler returns.
 class STree {
     STree(STree &&other);
     STree &operator =(STree other);
 
+    std::function<void(ASTNode*)> handler;
+    void flush_root();
+
 public:
     STree();
     ~STree();
 
-    unique_ptr<ASTNode> root;
+    ASTArena arena;
+    ASTNode *root;
+    unsigned syntax_errors = 0;  // Statements skipped by the last parse
 
     void parse(std::istream &input);
+    // False if any statement had a syntax error
+    bool parse(llvm::StringRef source, std::function<void(ASTNode*)> handle);
 
     void set_root(FunctionNode *node);
     void set_root(PrototypeNode *node);